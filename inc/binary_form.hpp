@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+// What a binary expression has specialized itself to, from the operands it
+// was first run with. A specialized form guards on its operands having the
+// representation it was made for, and rewrites the expression to GENERIC for
+// good the first time they don't.
+enum class BinaryForm: uint8_t
+{
+    // Not run yet
+    UNSPECIALIZED,
+
+    // Anything Interpreter::applyBinary takes
+    GENERIC,
+
+    // Both operands small integers
+    INT_ADD,
+    INT_SUBTRACT,
+    INT_MULTIPLY,
+    INT_LESS,
+    INT_LESS_EQUAL,
+    INT_GREATER,
+    INT_GREATER_EQUAL,
+    INT_EQUAL,
+    INT_NOT_EQUAL,
+
+    // Both operands floats
+    FLOAT_ADD,
+    FLOAT_SUBTRACT,
+    FLOAT_MULTIPLY,
+    FLOAT_LESS,
+    FLOAT_LESS_EQUAL,
+    FLOAT_GREATER,
+    FLOAT_GREATER_EQUAL,
+
+    // Both operands strings
+    STRING_ADD,
+};
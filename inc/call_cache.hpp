@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+struct LoxObject;
+struct LoxCallable;
+struct LoxFunction;
+struct LoxNative;
+
+struct CallCacheStats
+{
+    uint64_t hits_{0};
+    uint64_t misses_{0};
+
+    // Misses at sites that already hold as many callees as they can, which
+    // go on being checked on every call
+    uint64_t megamorphic_{0};
+
+    // Sites emptied because old objects were freed since they were filled
+    uint64_t flushes_{0};
+};
+
+// Inline cache of a call site: the callees it has been seen calling with
+// the right number of arguments, each with how to enter it, so that calling
+// one of them again skips checking that it is callable and its arity.
+//
+// Callees live in the old space and never move, so they are recognized by
+// address. The sweep of a major collection may however free one and reuse
+// its memory for another, so the entries are only trusted as long as no old
+// object has been freed since they were filled: the epoch is the heap's
+// count of freed objects at that time.
+struct CallCache
+{
+    static constexpr size_t ENTRIES = 4;
+
+    struct Entry
+    {
+        const LoxObject* callee_{nullptr};
+
+        // How to enter the callee; exactly one is set
+        LoxFunction* function_{nullptr};
+        LoxNative* native_{nullptr};
+    };
+
+    std::array<Entry, ENTRIES> entries_{};
+    uint8_t size_{0};
+    uint64_t epoch_{0};
+
+    // The entry for this callee, null on a miss
+    const Entry* find(const LoxObject* callee, uint64_t epoch)
+    {
+        if (epoch != epoch_) {
+            if (size_ > 0) {
+                ++stats_.flushes_;
+            }
+            size_ = 0;
+            epoch_ = epoch;
+        }
+
+        for (size_t i = 0; i < size_; ++i) {
+            if (entries_[i].callee_ == callee) {
+                ++stats_.hits_;
+                return &entries_[i];
+            }
+        }
+
+        ++stats_.misses_;
+        return nullptr;
+    }
+
+    // Remembers a callee that has been checked to take the site's arguments,
+    // unless the site is full; returns how to enter it either way
+    Entry insert(LoxCallable* callee);
+
+    static const CallCacheStats& stats() { return stats_; }
+
+private:
+    static CallCacheStats stats_;
+};
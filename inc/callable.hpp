@@ -1,14 +1,26 @@
 #pragma once
 
-#include <vector>
+#include <span>
 
 #include "value.hpp"
 
 struct Interpreter;
 
-struct LoxCallable: public LoxValue
+struct LoxCallable: public LoxObject
 {
-    virtual int arity() = 0;
-    virtual LoxValuePtr call(Interpreter& interpreter, std::vector<LoxValuePtr>& args) = 0;
+    LoxCallable(ObjType type, int arity) : LoxObject{type}, arity_{arity} {}
+
+    int arity() const { return arity_; }
+
+private:
+    int arity_;
 };
 
+// Function implemented in C++. Its arguments are read in place from the
+// interpreter's stack, which must not grow while they are in use.
+struct LoxNative: public LoxCallable
+{
+    LoxNative(int arity) : LoxCallable{ObjType::NATIVE, arity} {}
+
+    virtual Value call(Interpreter& interpreter, std::span<Value> args) = 0;
+};
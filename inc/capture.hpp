@@ -0,0 +1,9 @@
+#pragma once
+
+// Where a closure gets one of its upvalues from when it is created: a slot
+// of the enclosing function's frame, or an upvalue of the enclosing function.
+struct Capture
+{
+    bool local_;
+    int index_;
+};
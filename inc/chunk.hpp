@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ref.hpp"
+#include "token.hpp"
+#include "value.hpp"
+
+struct FunctionStmt;
+struct GlobalCell;
+
+// Instructions of the bytecode VM. Operands follow the opcode in the code
+// stream: `k` constant, `s` frame slot, `u` upvalue, `g` global, `t` token
+// (for the line of a runtime error), `n` count and `o` jump offset are 16
+// bits, `a` argument count is 8 bits.
+#define LOX_OPCODES(X) \
+    X(CONSTANT)         /* k       -> value */ \
+    X(NIL)              /*         -> nil */ \
+    X(POP)              /* value   -> */ \
+    X(POP_RESULT)       /* value   -> ; sets Interpreter::result_ */ \
+    X(RESULT)           /* value   -> value ; sets Interpreter::result_, in REPL mode */ \
+    X(POPN)             /* n values -> */ \
+    X(RESERVE)          /* -> n nils, the slots of a block frame */ \
+    X(GET_LOCAL)        /* s       -> value */ \
+    X(SET_LOCAL)        /* s value -> value */ \
+    X(GET_UPVALUE)      /* u       -> value */ \
+    X(SET_UPVALUE)      /* u value -> value */ \
+    X(GET_GLOBAL)       /* g       -> value */ \
+    X(SET_GLOBAL)       /* g value -> value */ \
+    X(DEFINE_GLOBAL)    /* g value -> value */ \
+    X(EQUAL)            /* a b     -> bool */ \
+    X(NOT_EQUAL)        /* a b     -> bool */ \
+    X(GREATER)          /* t a b   -> bool */ \
+    X(GREATER_EQUAL)    /* t a b   -> bool */ \
+    X(LESS)             /* t a b   -> bool */ \
+    X(LESS_EQUAL)       /* t a b   -> bool */ \
+    X(ADD)              /* t a b   -> value */ \
+    X(SUBTRACT)         /* t a b   -> value */ \
+    X(MULTIPLY)         /* t a b   -> value */ \
+    X(DIVIDE)           /* t a b   -> value */ \
+    X(NOT)              /* value   -> bool */ \
+    X(NEGATE)           /* t value -> value */ \
+    X(PRINT)            /* value   -> ; sets Interpreter::result_ */ \
+    X(SHOW)             /* prints Interpreter::result_, in REPL mode */ \
+    X(JUMP)             /* o, forwards */ \
+    X(JUMP_IF_FALSE)    /* o value -> value */ \
+    X(JUMP_IF_TRUE)     /* o value -> value */ \
+    X(POP_JUMP_IF_FALSE) /* o value -> */ \
+    X(LOOP)             /* o, backwards; a safepoint */ \
+    X(CALL)             /* a t callee args -> value */ \
+    X(TAIL_CALL)        /* a t callee args -> ; returns the call's value */ \
+    X(RETURN)           /* value   -> ; returns it */ \
+    X(RETURN_NIL)       /* returns nil */ \
+    X(CLOSURE)          /* f       -> function, f indexing Chunk::functions_ */ \
+    X(CLASS)            /* t       -> class named by the token */ \
+    X(CLOSE_UPVALUES)   /* s, closes the upvalues of slot s onwards */
+
+enum class OpCode: uint8_t
+{
+#define LOX_OPCODE_ENUM(name) name,
+    LOX_OPCODES(LOX_OPCODE_ENUM)
+#undef LOX_OPCODE_ENUM
+};
+
+// A global variable as a chunk refers to it, with the cell it is found in
+// once it has been looked up
+struct GlobalRef
+{
+    TokenPtr name_;
+    GlobalCell* cell_{nullptr};
+};
+
+// Bytecode of a function, or of the top-level code of a script. Compiled
+// functions keep theirs in FunctionStmt::chunk_.
+struct Chunk: public RefCounted
+{
+    std::vector<uint8_t> code_;
+
+    // Literals, which are permanent objects and need no marking
+    std::vector<Value> constants_;
+
+    std::vector<GlobalRef> globals_;
+    std::vector<TokenPtr> tokens_;
+
+    // Functions declared directly in this code, owned by its AST
+    std::vector<FunctionStmt*> functions_;
+
+    // Most values the code has on the stack at once, counting its frame
+    size_t maxStack_{0};
+};
+
+using ChunkPtr = Ref<Chunk>;
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <functional>
+
+#include "completion.hpp"
+#include "ref.hpp"
+#include "value.hpp"
+
+// Code made by ClosureCompiler: every node of the AST becomes a C++
+// callable bound to its operands, which runs it when invoked
+using ExprCode = std::function<Value()>;
+using StmtCode = std::function<Completion()>;
+
+// Body of a function compiled by ClosureCompiler, which keeps it in
+// FunctionStmt::closureCode_
+struct ClosureCode: public RefCounted
+{
+    StmtCode body_;
+};
+
+using ClosureCodePtr = Ref<ClosureCode>;
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "closure_code.hpp"
+#include "interpreter.hpp"
+#include "stack_limit.hpp"
+
+// Runs the resolved AST on the interpreter's state after compiling it once
+// into a tree of C++ callables.
+//
+// Each node becomes a lambda specialized for its kind, and for its operator
+// or the kind of variable it refers to, holding the code of its children.
+// Running the code is then a chain of direct calls, with no visitor double
+// dispatch and no Interpreter::result_ in between: expressions return
+// their value, statements how they were left. Frames, upvalues, globals and
+// runtime errors are those of the interpreter, and a function's body is
+// compiled into FunctionStmt::closureCode_ when its declaration is.
+//
+// Lox calls recurse on the native stack. Calls past `maxDepth`, or once
+// the native stack used since interpret() was entered passes most of its
+// size limit, fail with a "Stack overflow." runtime error. Compiling
+// recurses along the AST too, and fails past the same limit with a "Too
+// deeply nested." compile error. The code it builds takes several times
+// less native stack per node when it runs, which fits in what the calls
+// leave.
+class ClosureCompiler: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
+{
+public:
+    ClosureCompiler(Interpreter& interpreter, size_t maxDepth);
+
+    void interpret(const std::vector<StmtPtr>& statements);
+
+    // Visitor methods for Expressions
+    void visitAssignExpr(AssignExprPtr expr) override;
+    void visitBinaryExpr(BinaryExprPtr expr) override;
+    void visitGroupingExpr(GroupingExprPtr expr) override;
+    void visitLiteralExpr(LiteralExprPtr expr) override;
+    void visitUnaryExpr(UnaryExprPtr expr) override;
+    void visitVariableExpr(VariableExprPtr expr) override;
+    void visitLogicalExpr(LogicalExprPtr expr) override;
+    void visitCallExpr(CallExprPtr expr) override;
+
+    // Visitor methods for Statements
+    void visitWhileStmt(WhileStmtPtr stmt) override;
+    void visitIfStmt(IfStmtPtr stmt) override;
+    void visitBlockStmt(BlockStmtPtr stmt) override;
+    void visitExpressionStmt(ExpressionStmtPtr stmt) override;
+    void visitPrintStmt(PrintStmtPtr stmt) override;
+    void visitVarStmt(VarStmtPtr stmt) override;
+    void visitFunctionStmt(FunctionStmtPtr stmt) override;
+    void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
+    void visitClassStmt(ClassStmtPtr stmt) override;
+
+private:
+    Interpreter& interpreter_;
+    size_t maxDepth_;
+
+    // Number of calls running
+    size_t depth_{0};
+
+    // Native stack used since interpret() was entered
+    StackLimit stack_;
+
+    // Code of the node visited last
+    ExprCode expr_;
+    StmtCode stmt_;
+
+    ExprCode compile(const ExprPtr& expr);
+    StmtCode compile(const StmtPtr& stmt);
+    void checkNesting() const;
+
+    // Compiles a statement the way Interpreter::execute runs it, showing
+    // Interpreter::result_ after it in REPL mode
+    StmtCode statement(const StmtPtr& stmt);
+
+    // Code running statements in the current frame, with a safepoint
+    // before each, up to the first one not left normally
+    StmtCode sequence(const std::vector<StmtPtr>& statements);
+
+    // Evaluates a call's callee and arguments onto the stack; returns where
+    // they start
+    size_t prepareCall(const ExprCode& callee, const std::vector<ExprCode>& args);
+    Value finishCall(size_t base, const CallCache::Entry& callee, const TokenPtr& paren);
+
+    // Compiles the condition of an `if` or a loop, which becomes the result
+    // as it does in the interpreter
+    ExprCode condition(const ExprPtr& expr);
+
+    // Runs the compiled body of a function in a frame starting at stack
+    // index `frame`, making the calls it returns in tail position in turn
+    Value call(LoxFunction* function, size_t frame, const TokenPtr& paren);
+};
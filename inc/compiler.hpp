@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+#include "statement_compiler.hpp"
+
+// Compiles the resolved AST to bytecode for the VM.
+//
+// Locals, upvalues and globals are laid out exactly as the resolver
+// numbered them for the tree-walking interpreter: a function's frame holds
+// its parameters and locals in their slots, with the temporaries above, and
+// a top-level block that owns a frame reserves its slots where it starts.
+// Every function is compiled once, into FunctionStmt::chunk_, when the code
+// declaring it is.
+struct Compiler: public StatementCompiler
+{
+    Compiler(bool repl_mode = false);
+
+    // Compiles the top-level code of a script
+    ChunkPtr compile(const std::vector<StmtPtr>& statements);
+
+    // Visitor methods for Expressions
+    void visitAssignExpr(AssignExprPtr expr) override;
+    void visitBinaryExpr(BinaryExprPtr expr) override;
+    void visitGroupingExpr(GroupingExprPtr expr) override;
+    void visitLiteralExpr(LiteralExprPtr expr) override;
+    void visitUnaryExpr(UnaryExprPtr expr) override;
+    void visitVariableExpr(VariableExprPtr expr) override;
+    void visitLogicalExpr(LogicalExprPtr expr) override;
+    void visitCallExpr(CallExprPtr expr) override;
+
+    // Visitor methods for Statements
+    void visitWhileStmt(WhileStmtPtr stmt) override;
+    void visitIfStmt(IfStmtPtr stmt) override;
+    void visitBlockStmt(BlockStmtPtr stmt) override;
+    void visitExpressionStmt(ExpressionStmtPtr stmt) override;
+    void visitPrintStmt(PrintStmtPtr stmt) override;
+    void visitVarStmt(VarStmtPtr stmt) override;
+    void visitFunctionStmt(FunctionStmtPtr stmt) override;
+    void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
+    void visitClassStmt(ClassStmtPtr stmt) override;
+
+private:
+    // A block being compiled, and what leaving it takes
+    struct Scope
+    {
+        int closeFrom_;
+
+        // Slots reserved by a block that owns a frame, 0 for the others
+        int frameSize_;
+    };
+
+    Chunk* chunk_{nullptr};
+
+    // Values on the stack above the frame's start at this point of the code
+    size_t depth_{0};
+
+    // Where the slots the resolver numbered start in the frame
+    size_t slotBase_{0};
+
+    std::vector<Scope> scopes_;
+
+    void compile(const StmtPtr& stmt) override;
+    void compile(const ExprPtr& expr);
+
+    void emitShow() override;
+
+    // Compiles the condition of an `if` or a loop, which becomes the result
+    // as it does in the interpreter
+    void condition(const ExprPtr& expr);
+
+    void compileFunction(FunctionStmt& stmt);
+
+    // Stores the value on top of the stack into a newly declared variable,
+    // leaving it there
+    void declare(int slot, const TokenPtr& name);
+
+    // Emits the cleanup of the scopes a jump to an enclosing loop leaves
+    void leaveScopes(size_t scopes);
+
+    // `effect` is the change of the stack depth the instruction makes
+    void emit(OpCode op, int effect);
+    void emitByte(uint8_t byte);
+    void emitShort(size_t value);
+
+    size_t emitJump(OpCode op, int effect);
+    void patchJump(size_t operand);
+    void emitLoop(size_t start);
+
+    uint16_t slot(int slot);
+    uint16_t constant(const Value& value);
+    uint16_t token(const TokenPtr& token);
+    uint16_t global(const TokenPtr& name);
+};
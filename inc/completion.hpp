@@ -0,0 +1,15 @@
+#pragma once
+
+// How the last statement executed was left. Anything but NORMAL skips the
+// rest of the enclosing statements up to the loop or call that handles it.
+enum class Completion
+{
+    NORMAL,
+    RETURN,
+    BREAK,
+    CONTINUE,
+
+    // A return of a call to a LoxFunction, left in Interpreter::tailCall_
+    // for the caller's LoxFunction::call to make in the same frame
+    TAIL_CALL,
+};
@@ -1,43 +1,117 @@
 #pragma once
 
+#include <deque>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 #include "value.hpp"
 #include "token.hpp"
+#include "heap.hpp"
+#include "string_table.hpp"
 
-struct Environment: public std::enable_shared_from_this<Environment>
+// A variable captured by a closure. While the frame it was declared in is
+// live, the upvalue is open and refers to the variable's slot on the
+// interpreter's stack; once the variable goes out of scope it is closed,
+// holding the value itself. All the closures that capture a variable share
+// its upvalue.
+struct Upvalue: public GcObject
 {
-    Environment() = default;
-    Environment(std::shared_ptr<Environment> parent);
+    Upvalue(Heap& heap, std::vector<Value>& stack, size_t index);
 
-    void define(const std::string& name, LoxValuePtr value);
+    Value get() const { return open_ ? stack_[index_] : closed_; }
+    void set(const Value& value);
 
-    LoxValuePtr get(TokenPtr token);
-    LoxValuePtr getAt(int distance, const std::string& name);
+    void close();
 
-    void assign(TokenPtr token, LoxValuePtr value);
-    void assignAt(int distance, TokenPtr token, LoxValuePtr value);
+    void trace(Heap& heap) override;
+    size_t footprint() const override { return sizeof(Upvalue); }
+
+    // Index of the variable on the stack, while open
+    size_t index_;
+    bool open_{true};
 
 private:
-    std::unordered_map<std::string, LoxValuePtr> values_;
-    std::shared_ptr<Environment> parent_;
+    // For the write barrier
+    Heap& heap_;
 
-    std::shared_ptr<Environment> ancestor(int distance);
+    std::vector<Value>& stack_;
+    Value closed_{Value::nil()};
 };
 
-struct EnvGuard
+// The upvalues still referring to a slot of a value stack, in stack order,
+// so that the closures capturing a variable find its upvalue
+struct OpenUpvalues
 {
-    EnvGuard(std::shared_ptr<Environment>& currentEnv, std::shared_ptr<Environment> oldEnv)
-        : newEnv_{currentEnv}, oldEnv_{oldEnv}
-    {}
+    OpenUpvalues(Heap& heap, std::vector<Value>& stack)
+        : heap_{heap}
+        , stack_{stack}
+    { }
 
-    ~EnvGuard() {
-        newEnv_ = oldEnv_;
-    }
+    // Upvalue of the slot at `index`, made if it has none yet
+    Upvalue* capture(size_t index);
+
+    // Closes the upvalues of the slots from `index` onwards
+    void close(size_t index);
+
+    void markRoots(Heap& heap);
 
 private:
-    std::shared_ptr<Environment>& newEnv_;
-    std::shared_ptr<Environment> oldEnv_;
+    Heap& heap_;
+    std::vector<Value>& stack_;
+    std::vector<Upvalue*> upvalues_;
 };
 
+// A global variable. It exists from the first time its name is defined or
+// referred to, and is an error to use until it is defined.
+struct GlobalCell
+{
+    Value value_{Value::nil()};
+    bool defined_{false};
+};
+
+// Global scope. Globals may be referred to before they are defined, so they
+// can't be resolved ahead of time; instead every reference site looks its
+// cell up by name once, and keeps a pointer to it in `cache`. Cells are
+// never removed and never move.
+//
+// It is not an object of the heap, but one of the interpreter's roots.
+struct GlobalEnvironment
+{
+    void define(LoxString* name, const Value& value);
+
+    Value get(const TokenPtr& token, GlobalCell*& cache)
+    {
+        auto cell = lookup(token, cache);
+        return cell->value_;
+    }
+
+    void assign(const TokenPtr& token, GlobalCell*& cache, const Value& value)
+    {
+        auto cell = lookup(token, cache);
+        cell->value_ = value;
+    }
+
+    void markRoots(Heap& heap);
+
+private:
+    std::unordered_map<LoxString*, GlobalCell*, StringHash> index_;
+    std::deque<GlobalCell> cells_;
+
+    GlobalCell* cell(LoxString* name);
+
+    GlobalCell* lookup(const TokenPtr& token, GlobalCell*& cache)
+    {
+        if (!cache) {
+            cache = cell(token->symbol_);
+        }
+
+        if (!cache->defined_) {
+            undefined(token);
+        }
+
+        return cache;
+    }
+
+    [[noreturn]] void undefined(const TokenPtr& token);
+};
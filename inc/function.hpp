@@ -3,19 +3,28 @@
 #include "callable.hpp"
 #include "stmt.hpp"
 
-struct Environment;
+struct Upvalue;
 
 struct LoxFunction: public LoxCallable
 {
-    LoxFunction(FunctionStmtPtr declaration, std::shared_ptr<Environment> closure);
+    LoxFunction(FunctionStmtPtr declaration, std::vector<Upvalue*> upvalues);
 
-    int arity() override;
-    LoxValuePtr call(Interpreter& interpreter, std::vector<LoxValuePtr>& args) override;
+    // Runs the function in a frame starting at stack index `frame`, where
+    // the caller has evaluated the arguments, right above the function
+    Value call(Interpreter& interpreter, size_t frame);
     
     std::ostream& operator<<(std::ostream& o) override;
 
+    const FunctionStmtPtr& declaration() const { return declaration_; }
+    Upvalue* upvalue(int index) const { return upvalues_[index]; }
+
+    void trace(Heap& heap) override;
+    size_t footprint() const override { return sizeof(LoxFunction) + upvalues_.capacity() * sizeof(Upvalue*); }
+
 private:
     FunctionStmtPtr declaration_;
-    std::shared_ptr<Environment> closure_;
-};
 
+    // Only the variables the function captures, in the order of
+    // declaration_->captures_
+    std::vector<Upvalue*> upvalues_;
+};
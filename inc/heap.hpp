@@ -0,0 +1,330 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "marker.hpp"
+#include "slab_allocator.hpp"
+
+class Heap;
+class Value;
+
+// Base of every object owned by the garbage collector.
+struct GcObject: public SlabAllocated
+{
+    // Only types that opt in are allocated in the nursery; everything else
+    // is allocated directly in the old space and never moves.
+    static constexpr bool MOVABLE = false;
+
+    // Link in the old space object list. For a young object that has been
+    // copied out of the nursery, its new address.
+    GcObject* next_{nullptr};
+
+    bool marked_{false};
+    bool young_{false};
+
+    // Set while the object is in the heap's remembered set
+    bool remembered_{false};
+
+    // See GcLock
+    bool locked_{false};
+
+    virtual ~GcObject() = default;
+
+    // Passes every reference slot of this object to Heap::mark()
+    virtual void trace(Heap&) {}
+
+    // Approximate number of bytes owned by this object
+    virtual size_t footprint() const = 0;
+
+    // Moves a young object into the old space. Only MOVABLE types implement it.
+    virtual GcObject* relocate(SlabAllocator&) { return this; }
+};
+
+// Spin lock on an object's header. While marking runs concurrently, it is
+// held by a marker tracing the object and by the mutator changing the
+// object's references.
+class GcLock
+{
+public:
+    GcLock(GcObject* object)
+        : locked_{object->locked_}
+    {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    ~GcLock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+private:
+    std::atomic_ref<bool> locked_;
+};
+
+// Anything holding references the collector can't discover by tracing,
+// e.g. the interpreter's current environment and in-flight values. The
+// slots are passed by reference, since a minor collection moves objects.
+struct GcRoots
+{
+    virtual void markRoots(Heap& heap) = 0;
+};
+
+struct HeapConfig
+{
+    // Heap size that triggers the first collection
+    size_t initialThreshold_{1024 * 1024};
+
+    // After a collection, the next one is triggered once the heap has grown
+    // to this multiple of the surviving bytes
+    double growthFactor_{2.0};
+
+    // Size of the nursery young objects are bump allocated from; 0 allocates
+    // everything in the old space
+    size_t nurserySize_{512 * 1024};
+
+    // Number of threads marking in a major collection
+    unsigned markThreads_{1};
+
+    // Mark in the background while the program keeps running, and sweep in
+    // slices, instead of stopping it for the whole major collection
+    bool concurrent_{false};
+
+    // Longest a remark or sweep slice of a concurrent collection may take,
+    // in microseconds. The initial pause marks the roots right after a minor
+    // collection, and is bounded by their size and the nursery's instead.
+    uint64_t pauseBudgetUs_{1000};
+
+    // Collect at every safepoint, to flush out missing roots
+    bool stress_{false};
+};
+
+struct PauseStats
+{
+    // Bucket i counts the pauses shorter than 2^i microseconds, the last
+    // one everything longer
+    static constexpr size_t BUCKETS = 20;
+
+    uint64_t pauses_{0};
+    uint64_t totalPauseNs_{0};
+    uint64_t maxPauseNs_{0};
+    std::array<uint64_t, BUCKETS> histogram_{};
+
+    void record(uint64_t pauseNs);
+};
+
+struct GcStats
+{
+    PauseStats minor_;
+
+    // Every pause of a major collection: a whole stop-the-world collection,
+    // or the initial mark, remark and sweep slices of a concurrent one
+    PauseStats major_;
+    uint64_t majorCollections_{0};
+
+    uint64_t objectsPromoted_{0};
+    uint64_t bytesPromoted_{0};
+    uint64_t objectsFreed_{0};
+    uint64_t bytesFreed_{0};
+};
+
+// Generational garbage collected heap.
+//
+// Young objects of MOVABLE types are bump allocated in a nursery. A minor
+// collection copies the ones reachable from the roots and the remembered
+// set into the old space and resets the nursery. The old space is made of
+// objects allocated from a SlabAllocator, threaded onto an intrusive list
+// and reclaimed by mark-sweep in a major collection.
+//
+// Old objects that are written a reference to a young one must go through
+// writeBarrier(), which records them in the remembered set.
+//
+// Collections only happen at safepoints, where the interpreter holds no
+// object pointers outside its roots. Allocation never collects; it only
+// requests a collection once the nursery is full or the old space has
+// outgrown its threshold.
+//
+// Permanent objects (interned strings, literals the AST refers to) are kept
+// on a separate list, never swept and therefore never traced; they must not
+// refer to collectable objects.
+//
+// Major collections can mark with several threads (see Marker). In
+// concurrent mode the mutator keeps running while they mark: the roots are
+// snapshotted in a short initial pause, and writeBarrier() then also shades
+// the references the mutator overwrites, so that everything reachable at
+// the snapshot gets marked. Old objects allocated meanwhile start out
+// marked, and young objects are live for the rest of the cycle. Minor
+// collections still happen in between. Once the markers run dry, remark
+// slices finish marking and the old space is swept in slices, all of which
+// stay within the pause budget.
+class Heap
+{
+public:
+    Heap(HeapConfig config = {});
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        if constexpr (T::MOVABLE) {
+            if (auto memory = allocateYoung(sizeof(T))) {
+                T* object = ::new (memory) T(std::forward<Args>(args)...);
+                object->young_ = true;
+                youngObjects_.push_back(object);
+                return object;
+            }
+        }
+
+        T* object = allocator_.make<T>(std::forward<Args>(args)...);
+        track(object, objects_);
+
+        if constexpr (T::MOVABLE) {
+            // Allocated in the old space because the nursery is full, but it
+            // may have been handed young objects
+            remember(object);
+        }
+
+        return object;
+    }
+
+    template <typename T, typename... Args>
+    T* makePermanent(Args&&... args)
+    {
+        T* object = allocator_.make<T>(std::forward<Args>(args)...);
+        track(object, permanent_);
+        return object;
+    }
+
+    void addRoots(GcRoots* roots);
+    void removeRoots(GcRoots* roots);
+
+    // Called when `value` is stored into `owner`
+    void writeBarrier(GcObject* owner, const Value& value);
+
+    // Called with the value a store into an object overwrites
+    void shade(const Value& value)
+    {
+        if (marking_) {
+            shadeObject(value);
+        }
+    }
+
+    void shade(GcObject* object)
+    {
+        if (marking_) {
+            markObject(object);
+        }
+    }
+
+    // Stores `value` into a slot of `owner`, going through both barriers
+    void store(GcObject* owner, Value& slot, const Value& value);
+
+    // True while markers may be tracing concurrently with the mutator, which
+    // must then hold a GcLock while changing an object's references
+    bool isMarking() const { return marking_; }
+
+    // Called from trace() and markRoots() for every reference slot
+    template <typename T>
+    void mark(T*& slot)
+    {
+        if (evacuating_) {
+            if (slot && slot->young_) {
+                slot = static_cast<T*>(evacuate(slot));
+            }
+        } else {
+            markObject(slot);
+        }
+    }
+
+    void mark(Value& slot);
+
+    void safepoint()
+    {
+        if (collectionPending_) {
+            collect();
+        }
+    }
+
+    void collect();
+
+    // Traces an object, locking it if the mutator runs concurrently
+    void traceObject(GcObject* object);
+
+    const GcStats& stats() const { return stats_; }
+    void printStats(std::ostream& o) const;
+
+private:
+    HeapConfig config_;
+    SlabAllocator allocator_;
+
+    // Nursery
+    char* nursery_{nullptr};
+    char* nurseryTop_{nullptr};
+    char* nurseryEnd_{nullptr};
+    std::vector<GcObject*> youngObjects_;
+
+    // Old space
+    GcObject* objects_{nullptr};
+    GcObject* permanent_{nullptr};
+    std::vector<GcObject*> remembered_;
+
+    // Objects of the old space still to be swept; survivors move back to
+    // objects_, as do objects allocated while sweeping
+    GcObject* unswept_{nullptr};
+
+    std::vector<GcRoots*> roots_;
+    std::vector<GcObject*> grayStack_;
+
+    // Set on the thread running a minor collection. Marker threads may call
+    // mark() at the same time, for a major collection.
+    static thread_local bool evacuating_;
+
+    enum class Phase
+    {
+        IDLE,
+        MARKING,
+        SWEEPING,
+    };
+
+    Phase phase_{Phase::IDLE};
+    bool marking_{false};
+    std::unique_ptr<Marker> marker_;
+
+    size_t bytesAllocated_{0};
+    size_t nextGC_;
+
+    bool minorRequested_{false};
+    bool collectionPending_{false};
+
+    GcStats stats_;
+
+    void* allocateYoung(size_t size);
+    void track(GcObject* object, GcObject*& list);
+    void remember(GcObject* object);
+    void requestMinor();
+
+    void markObject(GcObject* object);
+    void shadeObject(const Value& value);
+    GcObject* evacuate(GcObject* object);
+
+    void minorCollection();
+    void majorCollection();
+    void markRoots();
+    void startMarking();
+    void finishMarking();
+    void traceReferences();
+    void sweep(bool bounded);
+};
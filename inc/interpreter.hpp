@@ -1,22 +1,51 @@
 #pragma once
 
+#include "completion.hpp"
 #include "expr.hpp"
 #include "stmt.hpp"
 #include "environment.hpp"
+#include "string_table.hpp"
 
 #include <vector>
 
-struct Interpreter: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
+struct LoxFunction;
+struct interpreter_error;
+
+struct Interpreter: public Expr::AbstractVisitor, public Stmt::AbstractVisitor, public GcRoots
 {
-    Interpreter(bool repl_mode = false);
+    Interpreter(bool repl_mode = false, HeapConfig heapConfig = {});
+
+    // Declared first so that it outlives every object allocated from it
+    Heap heap_;
+    StringTable strings_;
 
     bool repl_mode_;
-    LoxValuePtr result_;
 
-    std::shared_ptr<Environment> global_;
-    std::shared_ptr<Environment> env_;
+    // Value of the last expression evaluated, or returned by a function
+    Value result_;
+    Completion completion_{Completion::NORMAL};
+
+    GlobalEnvironment global_;
+
+    // Frames of the running functions and top-level blocks, each holding
+    // the local variables in the slots the resolver gave them, and above
+    // them the values the interpreter holds on to while evaluating something
+    // else, e.g. the left operand of a binary expression or call arguments.
+    // Everything here is a root for the collector, and is updated when a
+    // minor collection moves it.
+    std::vector<Value> stack_;
 
-    std::unordered_map<ExprPtr, int> locals_;
+    // Where the innermost frame starts on the stack
+    size_t frame_{0};
+
+    // Running function, whose upvalues are reachable, null in top-level code
+    LoxFunction* function_{nullptr};
+
+    // Upvalues still referring to a slot on the stack
+    OpenUpvalues openUpvalues_{heap_, stack_};
+
+    // Callee and arguments of a pending tail call
+    std::vector<Value> tailCall_;
 
     // Visitor methods for Expressions
     void visitAssignExpr(AssignExprPtr expr) override;
@@ -37,32 +66,64 @@ struct Interpreter: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
     void visitVarStmt(VarStmtPtr stmt) override;
     void visitFunctionStmt(FunctionStmtPtr stmt) override;
     void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
     void visitClassStmt(ClassStmtPtr stmt) override;
 
     // Helpers
-    bool isTruthy(LoxValuePtr value);
-    bool isEqual(LoxValuePtr a, LoxValuePtr b);
+    bool isTruthy(const Value& value);
+    bool isEqual(const Value& a, const Value& b);
+
+    Value concatenate(LoxString* left, LoxString* right);
 
-    bool isBool(LoxValuePtr value);
-    bool isNum(LoxValuePtr value);
-    bool isFloat(LoxValuePtr value);
-    bool isString(LoxValuePtr value);
+    // Set result_ to the value of an operator applied to evaluated operands
+    void applyBinary(const TokenPtr& op, const Value& left, const Value& right);
 
-    int64_t getInt(LoxValuePtr value);
-    double getFloat(LoxValuePtr value);
+    // Same for the operator of `expr`, through the form it has specialized
+    // itself to, specializing it on its first run
+    void applyBinary(BinaryExpr& expr, const Value& left, const Value& right);
+    void applyUnary(const TokenPtr& op, const Value& right);
 
     // Checkers
-    void checkNumberOp(TokenPtr op, LoxValuePtr value);
-    void checkNumberOps(TokenPtr op, LoxValuePtr left, LoxValuePtr right);
+    void checkNumberOp(const TokenPtr& op, const Value& value);
+    void checkNumberOps(const TokenPtr& op, const Value& left, const Value& right);
 
-    LoxValuePtr evaluate(ExprPtr expr);
-    void execute(StmtPtr stmt);
-    void executeBlock(std::shared_ptr<std::vector<StmtPtr>> statements, std::shared_ptr<Environment> env);
+    // Evaluates the callee and the arguments of a call onto the stack;
+    // returns where they start
+    size_t prepareCall(CallExpr& expr);
 
-    LoxValuePtr lookupVariable(TokenPtr name, ExprPtr expr);
+    // Checks that the callee takes the arguments, going through the call
+    // site's inline cache; returns how to enter it
+    CallCache::Entry checkCall(CallExpr& expr, size_t base);
+    CallCache::Entry checkCallee(CallCache& cache, const TokenPtr& paren, const Value& callee, size_t argc);
+    void checkCallee(const TokenPtr& paren, const Value& callee, size_t argc);
 
-    void resolve(ExprPtr expr, int depth);
+    Value finishCall(CallExpr& expr, size_t base, const CallCache::Entry& callee);
+
+    Value evaluate(const ExprPtr& expr);
+    void execute(const StmtPtr& stmt);
+
+    // Prints the last value, in REPL mode
+    void show();
+
+    void executeBlock(const std::vector<StmtPtr>& statements);
+
+    // Runs `statements` in a new frame of `size` slots, made of the values
+    // on the stack from `base` onwards and as many nils as are missing. The
+    // upvalues of its slots from `closeFrom` onwards, if any, are closed
+    // when it is popped.
+    void executeFrame(const std::vector<StmtPtr>& statements, size_t base, int size, int closeFrom);
+
+    void assign(AssignExpr& expr, const Value& value);
+
+    // Defines a variable in the global scope, or at `slot` in the current frame
+    void declare(int slot, const TokenPtr& name, const Value& value);
 
     void interpret(const std::vector<StmtPtr>& statements);
+
+    // Reports a runtime error and drops whatever was running
+    void abort(const interpreter_error& error);
+
+    void markRoots(Heap& heap) override;
 };
 
@@ -2,7 +2,7 @@
 
 #include "value.hpp"
 
-struct LoxClass: public LoxValue
+struct LoxClass: public LoxObject
 {
     std::string name_;
 
@@ -10,5 +10,7 @@ struct LoxClass: public LoxValue
     ~LoxClass() = default;
 
     std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this) + name_.capacity(); }
 };
 
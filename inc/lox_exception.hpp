@@ -21,13 +21,19 @@ struct parsing_error: public std::runtime_error
     {}
 };
 
-struct return_value: public std::runtime_error
+// Raised by native functions, reported at the call site
+struct native_error: public std::runtime_error
 {
-    LoxValuePtr value_;
-
-    return_value(LoxValuePtr value)
-        : value_{value}
-        , std::runtime_error{""}
+    native_error(const std::string& msg)
+        : std::runtime_error{msg}
     {}
 };
 
+// Raised by the bytecode compiler for code beyond what its instructions
+// can encode
+struct compile_error: public std::runtime_error
+{
+    compile_error(const std::string& msg)
+        : std::runtime_error{msg}
+    {}
+};
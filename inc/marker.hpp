@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Heap;
+struct GcObject;
+
+// Parallel marking for the heap's major collections.
+//
+// Every worker owns a mark stack split in two: a private part it pushes to
+// and pops from without synchronization, and a shared part other workers
+// steal from when they run out of work. A worker publishes the older half
+// of its private stack whenever it grows large while the shared part is
+// empty. Objects pushed by any other thread (the roots, the snapshot
+// barrier) go to an injection queue every worker can take from.
+//
+// Marking either runs to completion with the calling thread helping
+// (markParallel), or in the background while the mutator keeps running
+// (startConcurrent / idle / finishConcurrent).
+//
+// The worker threads are started with the first collection and park
+// between collections, so that no pause pays for creating or joining them.
+class Marker
+{
+public:
+    Marker(Heap& heap, unsigned workers);
+    ~Marker();
+
+    Marker(const Marker&) = delete;
+    Marker& operator=(const Marker&) = delete;
+
+    // Queues an object whose references still need to be traced
+    void push(GcObject* object);
+
+    void markParallel();
+
+    // Objects the calling thread pushes after beginRoots() go straight to
+    // the first worker's stack, without locking, until startConcurrent()
+    // hands them to the background workers
+    void beginRoots();
+    void startConcurrent();
+
+    // True once the background workers have run out of work
+    bool idle() const;
+
+    // Stops the background workers if they still run, and traces whatever
+    // is left on the calling thread for up to about `budgetNs`; true once
+    // nothing is
+    bool finishConcurrent(uint64_t budgetNs);
+
+    // True while the background workers run
+    bool running() const { return background_; }
+
+    // Stops the background workers, abandoning their work, and joins every
+    // worker thread. The marker can't be used afterwards.
+    void shutdown();
+
+private:
+    static constexpr size_t PUBLISH_THRESHOLD = 64;
+
+    // Number of objects traced by finishConcurrent between two looks at the
+    // clock
+    static constexpr size_t DRAIN_CHECK_INTERVAL = 64;
+
+    struct WorkStack
+    {
+        std::vector<GcObject*> private_;
+
+        std::mutex lock_;
+        std::deque<GcObject*> shared_;
+        std::atomic<size_t> sharedSize_{0};
+    };
+
+    // Stack of the marking thread, if the calling thread is one
+    static thread_local WorkStack* current_;
+
+    Heap& heap_;
+
+    std::vector<std::unique_ptr<WorkStack>> stacks_;
+    WorkStack injected_;
+
+    // Indexed like stacks_, each started the first time its worker is needed
+    std::vector<std::thread> threads_;
+
+    // Parked workers wait for the generation to change, and join it if
+    // their index is at least first_
+    std::mutex parkLock_;
+    std::condition_variable wake_;
+    uint64_t generation_{0};
+    unsigned first_{0};
+    bool shutdown_{false};
+
+    // Workers that have not parked again since they were woken
+    std::atomic<unsigned> active_{0};
+
+    // Workers that may still hold or produce work
+    std::atomic<unsigned> busy_{0};
+    std::atomic<bool> stop_{false};
+    bool concurrent_{false};
+    bool background_{false};
+
+    // Wakes the parked workers from `first` on, starting them if needed
+    void wake(unsigned first);
+    void park(unsigned index);
+
+    // Waits for the woken workers to park again
+    void waitParked();
+
+    void work(unsigned index);
+    GcObject* next(WorkStack& stack);
+    bool steal(WorkStack& from, WorkStack& to);
+    void publish(WorkStack& stack);
+    bool hasVisibleWork() const;
+};
@@ -2,11 +2,14 @@
 
 #include "callable.hpp"
 
-struct NativeClock: public LoxCallable
+struct NativeClock: public LoxNative
 {
-    int arity() override;
-    LoxValuePtr call(Interpreter& interpreter, std::vector<LoxValuePtr>& args) override;
+    NativeClock();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
     
     std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
 };
 
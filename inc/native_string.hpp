@@ -0,0 +1,68 @@
+#pragma once
+
+#include "callable.hpp"
+
+// String natives. Results that are part of their argument are returned as
+// slices sharing the argument's characters.
+
+// length(string): number of characters
+struct NativeLength: public LoxNative
+{
+    NativeLength();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
+
+    std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
+};
+
+// substring(string, start, end): characters in [start, end)
+struct NativeSubstring: public LoxNative
+{
+    NativeSubstring();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
+
+    std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
+};
+
+// indexOf(string, needle): position of the first occurrence, or -1
+struct NativeIndexOf: public LoxNative
+{
+    NativeIndexOf();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
+
+    std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
+};
+
+// trim(string): string without leading and trailing whitespace
+struct NativeTrim: public LoxNative
+{
+    NativeTrim();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
+
+    std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
+};
+
+// split(string, separator, index): the index-th field of the string split
+// on separator, or nil if there are not that many fields. Lox has no list
+// type, so fields are fetched one at a time.
+struct NativeSplit: public LoxNative
+{
+    NativeSplit();
+
+    Value call(Interpreter& interpreter, std::span<Value> args) override;
+
+    std::ostream& operator<<(std::ostream& o) override;
+
+    size_t footprint() const override { return sizeof(*this); }
+};
@@ -14,8 +14,31 @@ class Parser
     size_t current_{0};
     bool parsing_failed_{false};
 
+    // Deepest expressions and statements may nest, so that neither the
+    // parser nor the passes walking the AST recursively run out of native
+    // stack
+    size_t maxNesting_;
+    size_t nesting_{0};
+
+    // Set once maxNesting_ is passed, after which parsing gives up instead
+    // of reporting every level it unwinds
+    bool too_deep_{false};
+
     parsing_error error(TokenPtr token, const std::string& msg);
 
+    // Holds one level of nesting for as long as it lives, failing past
+    // maxNesting_
+    struct Nesting
+    {
+        Parser& parser_;
+
+        Nesting(Parser& parser);
+        ~Nesting() { --parser_.nesting_; }
+
+        Nesting(const Nesting&) = delete;
+        Nesting& operator=(const Nesting&) = delete;
+    };
+
     // Helpers
     TokenPtr peek();
     TokenPtr previous();
@@ -59,6 +82,8 @@ class Parser
     decltype(BlockStmt::statements_) parseBlock();
     StmtPtr parsePrintStmt();
     StmtPtr parseReturnStmt();
+    StmtPtr parseBreakStmt();
+    StmtPtr parseContinueStmt();
     StmtPtr parseExpressionStmt();
     StmtPtr parseStatement();
     StmtPtr parseVarDeclaration();
@@ -68,7 +93,14 @@ class Parser
 
     void synchronize();
 public:
-    Parser(const std::vector<TokenPtr>& tokens);
+    // Most native stack a level of nesting takes in any of the passes
+    // walking the AST, unoptimized
+    static constexpr size_t STACK_BYTES_PER_NESTING = 1024;
+
+    // As deep as the native stack lets the AST be walked
+    static size_t defaultMaxNesting();
+
+    Parser(const std::vector<TokenPtr>& tokens, size_t maxNesting = defaultMaxNesting());
 
     std::optional<std::vector<StmtPtr>> parse();
 };
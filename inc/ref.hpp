@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+// Base for objects owned through Ref. The count lives inside the object and
+// is updated with plain (non-atomic) operations, since the interpreter is
+// single threaded.
+struct RefCounted
+{
+    uint32_t refCount_{0};
+};
+
+// Intrusive reference counted handle, a lighter replacement for shared_ptr.
+template <typename T>
+class Ref
+{
+    T* ptr_{nullptr};
+
+    void retain()
+    {
+        if (ptr_) {
+            ++ptr_->refCount_;
+        }
+    }
+
+    void release()
+    {
+        if (ptr_ && --ptr_->refCount_ == 0) {
+            delete ptr_;
+        }
+    }
+
+    template <typename U>
+    friend class Ref;
+
+public:
+    Ref() = default;
+    Ref(std::nullptr_t) {}
+
+    explicit Ref(T* ptr) : ptr_{ptr} { retain(); }
+
+    Ref(const Ref& other) : ptr_{other.ptr_} { retain(); }
+    Ref(Ref&& other) noexcept : ptr_{other.ptr_} { other.ptr_ = nullptr; }
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Ref(const Ref<U>& other) : ptr_{other.ptr_} { retain(); }
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Ref(Ref<U>&& other) noexcept : ptr_{other.ptr_} { other.ptr_ = nullptr; }
+
+    Ref& operator=(const Ref& other)
+    {
+        Ref{other}.swap(*this);
+        return *this;
+    }
+
+    Ref& operator=(Ref&& other) noexcept
+    {
+        Ref{std::move(other)}.swap(*this);
+        return *this;
+    }
+
+    ~Ref() { release(); }
+
+    void swap(Ref& other) noexcept { std::swap(ptr_, other.ptr_); }
+
+    T* get() const { return ptr_; }
+    T* operator->() const { return ptr_; }
+    T& operator*() const { return *ptr_; }
+
+    explicit operator bool() const { return ptr_ != nullptr; }
+
+    template <typename U>
+    bool operator==(const Ref<U>& other) const { return ptr_ == other.ptr_; }
+    bool operator==(std::nullptr_t) const { return ptr_ == nullptr; }
+};
+
+template <typename T, typename... Args>
+Ref<T> makeRef(Args&&... args)
+{
+    return Ref<T>{new T(std::forward<Args>(args)...)};
+}
+
+template <typename T>
+struct std::hash<Ref<T>>
+{
+    size_t operator()(const Ref<T>& ref) const noexcept
+    {
+        return std::hash<T*>{}(ref.get());
+    }
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+#include "ref.hpp"
+#include "token.hpp"
+#include "value.hpp"
+
+struct FunctionStmt;
+
+// Three-address instructions of the register VM. `A`, `B` and `C` name
+// registers of the frame, `K` constants, and `RK` either: an operand with
+// RegisterChunk::CONSTANT set indexes the constants. Jump targets are
+// instruction indices.
+#define LOX_REGISTER_OPS(X) \
+    X(MOVE)             /* A B      R[A] = R[B] */ \
+    X(LOAD_CONSTANT)    /* A K      R[A] = K */ \
+    X(LOAD_NIL)         /* A        R[A] = nil */ \
+    X(GET_UPVALUE)      /* A u      R[A] = upvalue u */ \
+    X(SET_UPVALUE)      /* u RK     upvalue u = RK */ \
+    X(GET_GLOBAL)       /* A g      R[A] = global g */ \
+    X(SET_GLOBAL)       /* g RK     global g = RK */ \
+    X(DEFINE_GLOBAL)    /* g RK     defines global g as RK */ \
+    X(EQUAL)            /* A RK RK  R[A] = B == C */ \
+    X(NOT_EQUAL)        /* A RK RK */ \
+    X(GREATER)          /* A RK RK */ \
+    X(GREATER_EQUAL)    /* A RK RK */ \
+    X(LESS)             /* A RK RK */ \
+    X(LESS_EQUAL)       /* A RK RK */ \
+    X(ADD)              /* A RK RK */ \
+    X(SUBTRACT)         /* A RK RK */ \
+    X(MULTIPLY)         /* A RK RK */ \
+    X(DIVIDE)           /* A RK RK */ \
+    X(NOT)              /* A RK     R[A] = !B */ \
+    X(NEGATE)           /* A RK     R[A] = -B */ \
+    X(RESULT)           /* RK       sets Interpreter::result_, in REPL mode */ \
+    X(PRINT)            /* RK       prints it, and sets Interpreter::result_ */ \
+    X(SHOW)             /* prints Interpreter::result_, in REPL mode */ \
+    X(JUMP)             /* target, forwards */ \
+    X(JUMP_IF_FALSE)    /* RK target */ \
+    X(JUMP_IF_TRUE)     /* RK target */ \
+    X(LOOP)             /* target, backwards; a safepoint */ \
+    X(CALL)             /* A n      R[A] = R[A](R[A+1] .. R[A+n]) */ \
+    X(TAIL_CALL)        /* A n      returns R[A](R[A+1] .. R[A+n]) */ \
+    X(RETURN)           /* RK */ \
+    X(RETURN_NIL)       \
+    X(CLOSURE)          /* A f base R[A] = closure of function f, capturing from base */ \
+    X(CLASS)            /* A        R[A] = class named by the instruction's token */ \
+    X(CLOSE_UPVALUES)   /* A        closes the upvalues of R[A] onwards */
+
+enum class RegisterOp: uint8_t
+{
+#define LOX_REGISTER_OP_ENUM(name) name,
+    LOX_REGISTER_OPS(LOX_REGISTER_OP_ENUM)
+#undef LOX_REGISTER_OP_ENUM
+};
+
+struct Instruction
+{
+    RegisterOp op_;
+    uint16_t a_{0};
+    uint16_t b_{0};
+    uint16_t c_{0};
+};
+
+// Register code of a function, or of the top-level code of a script.
+// Compiled functions keep theirs in FunctionStmt::registerChunk_.
+struct RegisterChunk: public RefCounted
+{
+    // Operand bit selecting a constant instead of a register
+    static constexpr uint16_t CONSTANT = 0x8000;
+
+    std::vector<Instruction> code_;
+
+    // The token of each instruction that can fail, for the line of its
+    // runtime error, and of CLASS for its name
+    std::vector<TokenPtr> tokens_;
+
+    // Literals, which are permanent objects and need no marking
+    std::vector<Value> constants_;
+
+    std::vector<GlobalRef> globals_;
+
+    // Functions declared directly in this code, owned by its AST
+    std::vector<FunctionStmt*> functions_;
+
+    // Registers of the frame, its slots included
+    size_t registers_{0};
+};
+
+using RegisterChunkPtr = Ref<RegisterChunk>;
+
+// Lists the chunk's instructions, then those of the functions it declares
+void disassemble(std::ostream& o, const RegisterChunk& chunk, const std::string& name);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "register_chunk.hpp"
+#include "stack_limit.hpp"
+#include "statement_compiler.hpp"
+
+// Compiles the resolved AST to three-address code for the RegisterVM.
+//
+// A function's parameters and locals live in the registers numbered by the
+// slots the resolver gave them, and a top-level block that owns a frame
+// takes the registers above those in use where it starts. Temporaries are
+// allocated above all of those for the duration of a statement. Operands
+// that are variables or literals are read where they are, so `a = b + c`
+// on locals is the single instruction `ADD a, b, c`. Every function is
+// compiled once, into FunctionStmt::registerChunk_, when the code declaring
+// it is.
+struct RegisterCompiler: public StatementCompiler
+{
+    RegisterCompiler(bool repl_mode = false);
+
+    // Compiles the top-level code of a script
+    RegisterChunkPtr compile(const std::vector<StmtPtr>& statements);
+
+    // Visitor methods for Expressions
+    void visitAssignExpr(AssignExprPtr expr) override;
+    void visitBinaryExpr(BinaryExprPtr expr) override;
+    void visitGroupingExpr(GroupingExprPtr expr) override;
+    void visitLiteralExpr(LiteralExprPtr expr) override;
+    void visitUnaryExpr(UnaryExprPtr expr) override;
+    void visitVariableExpr(VariableExprPtr expr) override;
+    void visitLogicalExpr(LogicalExprPtr expr) override;
+    void visitCallExpr(CallExprPtr expr) override;
+
+    // Visitor methods for Statements
+    void visitWhileStmt(WhileStmtPtr stmt) override;
+    void visitIfStmt(IfStmtPtr stmt) override;
+    void visitBlockStmt(BlockStmtPtr stmt) override;
+    void visitExpressionStmt(ExpressionStmtPtr stmt) override;
+    void visitPrintStmt(PrintStmtPtr stmt) override;
+    void visitVarStmt(VarStmtPtr stmt) override;
+    void visitFunctionStmt(FunctionStmtPtr stmt) override;
+    void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
+    void visitClassStmt(ClassStmtPtr stmt) override;
+
+private:
+    static constexpr int ANY = -1;
+
+    RegisterChunk* chunk_{nullptr};
+
+    // Next free register
+    uint16_t top_{0};
+
+    // Registers below this one hold variables, the others temporaries
+    uint16_t locals_{0};
+
+    // Register of the resolver's slot 0
+    uint16_t slotBase_{0};
+
+    // The closeFrom_ of each block being compiled
+    std::vector<int> scopes_;
+
+    // Register an expression must leave its value in, or ANY
+    int target_{ANY};
+
+    // Operand holding the value of the expression last compiled
+    uint16_t operand_{0};
+
+    // Native stack used since compile() was entered, which recurses along
+    // the AST
+    StackLimit stack_;
+
+    // Compiles a statement, freeing the temporaries it used
+    void compile(const StmtPtr& stmt) override;
+
+    // Returns the operand the value ends up in: `target` if one is given,
+    // else a variable's register, a constant, or a new temporary
+    uint16_t compile(const ExprPtr& expr, int target = ANY);
+
+    // Fails with a compile error once compiling has used most of the native
+    // stack
+    void checkNesting() const;
+
+    void emitShow() override;
+
+    // Compiles the condition of an `if` or a loop, which becomes the result
+    // as it does in the interpreter; returns its operand
+    uint16_t condition(const ExprPtr& expr);
+
+    void compileFunction(FunctionStmt& stmt);
+
+    // Compiles a call's callee and arguments into consecutive temporaries,
+    // returning the first
+    uint16_t callFrame(CallExpr& expr);
+
+    // Register the current expression's value goes to
+    uint16_t destination();
+
+    // Leaves the value in operand_, or in target_ if one was asked for
+    void produce(uint16_t operand);
+
+    void result(uint16_t operand);
+
+    uint16_t allocate();
+
+    size_t emit(RegisterOp op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0, const TokenPtr& token = {});
+    void patchJump(size_t jump);
+    uint16_t label(size_t index);
+
+    uint16_t slot(int slot);
+    uint16_t constant(const Value& value);
+    uint16_t global(const TokenPtr& name);
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "interpreter.hpp"
+#include "register_chunk.hpp"
+#include "register_compiler.hpp"
+#include "vm_stack.hpp"
+
+// Register based virtual machine running the code from RegisterCompiler.
+//
+// Like the VM it shares the interpreter's heap, globals and closures, and
+// keeps its frames on a value stack of its own that only grows when a call
+// needs more room. A frame is the window of registers its chunk asks for,
+// starting right above the callee, so a call's callee and arguments,
+// compiled into consecutive temporaries of the caller, become the callee's
+// frame in place. Every register a frame covers is cleared when it is
+// entered, and the stack is marked up to the highest register any active
+// frame covers.
+class RegisterVM: public GcRoots
+{
+public:
+    static constexpr size_t INITIAL_STACK_SLOTS = 64 * 1024;
+    static constexpr size_t DEFAULT_MAX_STACK_SLOTS = 16 * 1024 * 1024;
+
+    RegisterVM(Interpreter& interpreter, size_t maxDepth, bool disassemble = false,
+               size_t maxStackSlots = DEFAULT_MAX_STACK_SLOTS);
+    ~RegisterVM();
+
+    RegisterVM(const RegisterVM&) = delete;
+    RegisterVM& operator=(const RegisterVM&) = delete;
+
+    void interpret(const std::vector<StmtPtr>& statements);
+
+    void markRoots(Heap& heap) override;
+
+private:
+    struct CallFrame
+    {
+        // Null for top-level code
+        LoxFunction* function_;
+        RegisterChunk* chunk_;
+
+        // Where the code goes on once the callee returns
+        const Instruction* ip_;
+        Value* registers_;
+
+        // Highest register covered by this frame or the ones below it
+        Value* top_;
+    };
+
+    Interpreter& interpreter_;
+    RegisterCompiler compiler_;
+
+    size_t maxDepth_;
+    bool disassemble_;
+
+    VMStack stack_;
+
+    std::vector<CallFrame> frames_;
+
+    void run();
+
+    // Makes room for these many slots, rebasing the frames; false past
+    // `maxStackSlots`
+    bool growStack(size_t slots);
+
+    // Drops whatever was running when a runtime error was raised
+    void reset();
+};
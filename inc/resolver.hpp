@@ -4,8 +4,7 @@
 
 #include "expr.hpp"
 #include "stmt.hpp"
-
-struct Interpreter;
+#include "string_table.hpp"
 
 struct Resolver: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
 {
@@ -14,8 +13,6 @@ struct Resolver: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
         FUNCTION
     };
 
-    Resolver(Interpreter& interpreter);
-
     // Visitor methods for Expressions
     void visitAssignExpr(AssignExprPtr expr) override;
     void visitBinaryExpr(BinaryExprPtr expr) override;
@@ -35,25 +32,64 @@ struct Resolver: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
     void visitVarStmt(VarStmtPtr stmt) override;
     void visitFunctionStmt(FunctionStmtPtr stmt) override;
     void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
     void visitClassStmt(ClassStmtPtr stmt) override;
 
     bool resolve(const std::vector<StmtPtr>& stmts);
 
 private:
-    void resolve(std::shared_ptr<std::vector<StmtPtr>> stmts);
-    void resolve(StmtPtr stmt);
-    void resolve(ExprPtr expr);
-    void resolveLocal(ExprPtr expr, TokenPtr name);
-    void resolveFunction(FunctionStmtPtr stmt, FunctionType type);
-    void beginScope();
-    void endScope();
-    void declare(TokenPtr name);
-    void define(TokenPtr name);
-
-    Interpreter& interpreter_;
+    void resolve(const StmtPtr& stmt);
+    void resolve(const ExprPtr& expr);
+    struct Local
+    {
+        int slot_;
+        bool defined_;
+
+        // Set once a closure refers to it
+        bool captured_;
+    };
+
+    // A scope either gets a frame of its own at runtime, or has its
+    // variables stored in the enclosing one's, after the variables already
+    // there. Slots are numbered in declaration order; those of a scope that
+    // has ended are reused by the next one.
+    struct Scope
+    {
+        std::unordered_map<LoxString*, Local, StringHash> locals_;
+        bool ownsFrame_;
+
+        // Next free slot, and the number of slots needed so far
+        int nextSlot_;
+        int size_;
+    };
+
+    // A function being resolved, whose scopes start at scopes_[firstScope_].
+    // The first one stands for top-level code, and has no declaration.
+    struct FunctionScope
+    {
+        FunctionStmt* declaration_;
+        size_t firstScope_;
+    };
+
+    void resolveLocal(const TokenPtr& name, int& slot, int& upvalue);
+    Local* findLocal(size_t function, const TokenPtr& name);
+    int resolveUpvalue(size_t function, const TokenPtr& name);
+    int addCapture(size_t function, Capture capture);
+    void resolveFunction(const FunctionStmtPtr& stmt, FunctionType type);
+    void beginScope(bool ownsFrame);
+    Scope endScope();
+    bool hasFrame() const;
+    int declare(const TokenPtr& name);
+    void define(const TokenPtr& name);
+
     bool has_error_{false};
 
-    std::vector<std::unordered_map<std::string, bool>> scopes_;
+    std::vector<Scope> scopes_;
+    std::vector<FunctionScope> functions_{{nullptr, 0}};
     FunctionType currentFunction{FunctionType::NONE};
+
+    // Loops enclosing the current statement, within the current function
+    int loopDepth_{0};
 };
 
@@ -1,20 +1,77 @@
 #pragma once
 
+#include <iosfwd>
 #include <string>
 
+#include "closure_compiler.hpp"
 #include "interpreter.hpp"
+#include "parser.hpp"
+#include "register_vm.hpp"
+#include "stack_evaluator.hpp"
+#include "vm.hpp"
+
+// How resolved programs are run
+enum class Engine
+{
+    // Recursive walk of the AST
+    TREE,
+
+    // Walk of the AST driven by an explicit stack, see StackEvaluator
+    STACK,
+
+    // Bytecode compiled from the AST, run by the VM
+    BYTECODE,
+
+    // Three-address code compiled from the AST, run by the RegisterVM
+    REGISTER,
+
+    // The AST compiled into C++ callables, see ClosureCompiler
+    CLOSURE,
+};
+
+struct RunnerConfig
+{
+    Engine engine_{Engine::TREE};
+
+    // Deepest the engines other than TREE let calls nest
+    size_t maxDepth_{StackEvaluator::DEFAULT_MAX_DEPTH};
+
+    // Deepest expressions and statements may nest, 0 for as deep as the
+    // native stack allows
+    size_t maxNesting_{0};
+
+    // Lists the code the REGISTER engine compiled before running it
+    bool disassemble_{false};
+};
 
 struct Runner
 {
-    Runner(bool repl_mode = false) : interpreter_{repl_mode} {}
+    Runner(bool repl_mode = false, HeapConfig heapConfig = {}, RunnerConfig config = {})
+        : interpreter_{repl_mode, heapConfig}
+        , engine_{config.engine_}
+        , maxNesting_{config.maxNesting_ ? config.maxNesting_ : Parser::defaultMaxNesting()}
+        , stackEvaluator_{interpreter_, config.maxDepth_}
+        , vm_{interpreter_, config.maxDepth_}
+        , registerVM_{interpreter_, config.maxDepth_, config.disassemble_}
+        , closureCompiler_{interpreter_, config.maxDepth_}
+    {}
     
     void runFromFile(const char *file);
     void runFromPrompt();
 
+    void printStats(std::ostream& o);
+
 private:
     Interpreter interpreter_;
     std::string source_;
 
+    Engine engine_;
+    size_t maxNesting_;
+    StackEvaluator stackEvaluator_;
+    VM vm_;
+    RegisterVM registerVM_;
+    ClosureCompiler closureCompiler_;
+
     void run();
 };
 
@@ -5,10 +5,14 @@
 #include <optional>
 
 #include "token.hpp"
+#include "heap.hpp"
+#include "string_table.hpp"
 
 class Scanner
 {
     const std::string& program_;
+    Heap& heap_;
+    StringTable& strings_;
     std::vector<TokenPtr> tokens_;
 
     bool hasError_{false};
@@ -28,10 +32,10 @@ class Scanner
     
     void addToken(TokenType tokenType);
 
-    void addToken(TokenType tokenType, LoxValuePtr value)
+    void addToken(TokenType tokenType, Value value)
     {
         std::string lexeme = program_.substr(start_, current_ - start_);
-        tokens_.push_back(std::make_shared<Token>(tokenType, value, lexeme, line_));
+        tokens_.push_back(makeRef<Token>(tokenType, value, lexeme, line_));
     }
 
     void parseString();
@@ -43,7 +47,7 @@ class Scanner
     bool isAlphaNum(char c);
 
 public:
-    Scanner(const std::string& program);
+    Scanner(const std::string& program, Heap& heap, StringTable& strings);
 
     std::optional<std::vector<TokenPtr>> scanTokens();
 };
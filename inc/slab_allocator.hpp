@@ -0,0 +1,105 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <utility>
+
+// Size class allocator for interpreter objects.
+//
+// Memory is carved out of SLAB_SIZE aligned slabs, each of which serves a
+// single size class. Every size class keeps its own free list, so freed
+// objects are reused by the next allocation of the same size. The slab
+// header is found by masking an object's address, which lets objects be
+// freed without knowing the allocator they came from.
+class SlabAllocator
+{
+public:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t MAX_SMALL_SIZE = 256;
+    static constexpr size_t NUM_CLASSES = MAX_SMALL_SIZE / GRANULE;
+
+    SlabAllocator() = default;
+    ~SlabAllocator();
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    void* allocate(size_t size);
+    static void deallocate(void* ptr);
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        return new (*this) T(std::forward<Args>(args)...);
+    }
+
+    void printStats(std::ostream& o) const;
+
+private:
+    static constexpr uint32_t LARGE_CLASS = NUM_CLASSES;
+
+    struct FreeNode
+    {
+        FreeNode* next_;
+    };
+
+    struct Slab
+    {
+        SlabAllocator* owner_;
+        Slab* next_;
+        uint32_t sizeClass_;
+        uint32_t live_;
+    };
+
+    static constexpr size_t HEADER_SIZE = (sizeof(Slab) + GRANULE - 1) / GRANULE * GRANULE;
+
+    struct SizeClass
+    {
+        FreeNode* freeList_{nullptr};
+        char* cursor_{nullptr};
+        char* end_{nullptr};
+
+        Slab* slabs_{nullptr};
+        size_t slabCount_{0};
+        size_t live_{0};
+    };
+
+    std::array<SizeClass, NUM_CLASSES> classes_;
+    Slab* largeSlabs_{nullptr};
+    size_t largeLive_{0};
+
+    uint64_t allocations_{0};
+    uint64_t reused_{0};
+
+    static Slab* slabOf(void* ptr);
+    static size_t classSize(uint32_t sizeClass);
+
+    Slab* newSlab(uint32_t sizeClass, size_t bytes);
+    void* allocateLarge(size_t size);
+    void free(Slab* slab, void* ptr);
+};
+
+// Base for objects that live in a SlabAllocator. They are created with
+// `allocator.make<T>(...)` and released with a plain delete.
+struct SlabAllocated
+{
+    static void* operator new(size_t size, SlabAllocator& allocator)
+    {
+        return allocator.allocate(size);
+    }
+
+    static void operator delete(void* ptr, SlabAllocator&)
+    {
+        SlabAllocator::deallocate(ptr);
+    }
+
+    static void operator delete(void* ptr)
+    {
+        SlabAllocator::deallocate(ptr);
+    }
+
+    static void* operator new(size_t size) = delete;
+};
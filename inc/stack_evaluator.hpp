@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "interpreter.hpp"
+
+// Runs the resolved AST on the interpreter's state like Interpreter does,
+// but without recursing on the native stack.
+//
+// What is left to do is kept on an explicit stack of tasks: visiting a node
+// pushes the tasks finishing it below those evaluating its children, and
+// values flow through Interpreter::result_ and the interpreter's value
+// stack exactly as they do in the recursive walk. A call pushes a task
+// restoring the caller and runs the body in a frame on the value stack, so
+// the depth of Lox recursion is only bounded by `maxDepth`, past which the
+// call fails with a "Stack overflow." runtime error.
+//
+// break, continue and return pop tasks up to the loop or call they leave,
+// running the ones that pop frames, close upvalues or show a statement in
+// REPL mode on their way.
+class StackEvaluator: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
+{
+public:
+    static constexpr size_t DEFAULT_MAX_DEPTH = 1000000;
+
+    StackEvaluator(Interpreter& interpreter, size_t maxDepth = DEFAULT_MAX_DEPTH);
+
+    void interpret(const std::vector<StmtPtr>& statements);
+
+    // Visitor methods for Expressions
+    void visitAssignExpr(AssignExprPtr expr) override;
+    void visitBinaryExpr(BinaryExprPtr expr) override;
+    void visitGroupingExpr(GroupingExprPtr expr) override;
+    void visitLiteralExpr(LiteralExprPtr expr) override;
+    void visitUnaryExpr(UnaryExprPtr expr) override;
+    void visitVariableExpr(VariableExprPtr expr) override;
+    void visitLogicalExpr(LogicalExprPtr expr) override;
+    void visitCallExpr(CallExprPtr expr) override;
+
+    // Visitor methods for Statements
+    void visitWhileStmt(WhileStmtPtr stmt) override;
+    void visitIfStmt(IfStmtPtr stmt) override;
+    void visitBlockStmt(BlockStmtPtr stmt) override;
+    void visitExpressionStmt(ExpressionStmtPtr stmt) override;
+    void visitPrintStmt(PrintStmtPtr stmt) override;
+    void visitVarStmt(VarStmtPtr stmt) override;
+    void visitFunctionStmt(FunctionStmtPtr stmt) override;
+    void visitReturnStmt(ReturnStmtPtr stmt) override;
+    void visitBreakStmt(BreakStmtPtr stmt) override;
+    void visitContinueStmt(ContinueStmtPtr stmt) override;
+    void visitClassStmt(ClassStmtPtr stmt) override;
+
+private:
+    enum class Op: uint8_t
+    {
+        EVAL,           // expr_
+        EXEC,           // stmt_
+        SHOW,           // prints result_ in REPL mode
+
+        PUSH,           // pushes result_ on the value stack
+        ASSIGN,         // expr_: AssignExpr
+        BINARY,         // expr_: BinaryExpr, left operand on the value stack
+        UNARY,          // expr_: UnaryExpr
+        LOGICAL,        // expr_: LogicalExpr, left operand in result_
+        CALL,           // expr_: CallExpr, callee and arguments on the value stack
+        TAIL_CALL,      // same, in tail position
+
+        PRINT,          // stmt_
+        VAR,            // stmt_: VarStmt
+        IF,             // stmt_: IfStmt, condition in result_
+        WHILE,          // stmt_: WhileStmt, condition in result_
+        RETURN,         // result_ is the value returned
+
+        BLOCK,          // statements_ from index_ onwards
+        LOOP,           // stmt_: WhileStmt whose body is running
+        CLOSE,          // closes the upvalues from slot index_ of the frame
+        POP_FRAME,      // stmt_: BlockStmt, index_ is the enclosing frame
+        POP_CALL,       // function_ and index_ are the caller's function and frame
+    };
+
+    struct Task
+    {
+        Op op_;
+
+        union
+        {
+            Expr* expr_;
+            Stmt* stmt_;
+            const std::vector<StmtPtr>* statements_;
+            LoxFunction* function_;
+        };
+
+        size_t index_;
+    };
+
+    Interpreter& interpreter_;
+    size_t maxDepth_;
+
+    std::vector<Task> tasks_;
+
+    // Number of calls running
+    size_t depth_{0};
+
+    void push(Op op, Expr* expr) { tasks_.push_back(Task{op, {.expr_ = expr}, 0}); }
+    void push(Op op, Stmt* stmt, size_t index = 0) { tasks_.push_back(Task{op, {.stmt_ = stmt}, index}); }
+    void push(Op op, size_t index = 0) { tasks_.push_back(Task{op, {.expr_ = nullptr}, index}); }
+    void pushBlock(const std::vector<StmtPtr>& statements);
+
+    // Executes a statement the way Interpreter::execute does, printing its
+    // result in REPL mode
+    void pushStatement(Stmt* stmt);
+    void pushCall(CallExpr* call, Op op);
+
+    void run();
+
+    void call(CallExpr& expr);
+    void tailCall(CallExpr& expr);
+    void enterFunction(CallExpr& expr, LoxFunction* function, size_t frame);
+
+    // Pops tasks up to the innermost one running `op`, which is popped too
+    // and returned
+    Task unwind(Op op);
+
+    // Shows the body of a for loop left before its increment, which is
+    // otherwise shown with it
+    void showLeftIteration(const Task& loop);
+
+    void popFrame(const Task& task);
+    void popCall(const Task& task);
+};
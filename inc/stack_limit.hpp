@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Native stack the interpreter lets its recursive code use: three quarters
+// of the soft limit on its size, the rest being left to what runs in
+// between and to the unwinding of an error
+size_t stackBudget();
+
+// How much native stack recursive code has used since start(), so that it
+// can fail cleanly before running out of it
+class StackLimit
+{
+public:
+    explicit StackLimit(size_t bytes)
+        : bytes_{bytes}
+    {}
+
+    void start()
+    {
+        char base;
+        base_ = reinterpret_cast<uintptr_t>(&base);
+    }
+
+    // True once more than the limit is used below where start() was called;
+    // the native stack grows downwards
+    bool exceeded() const
+    {
+        char top;
+        return base_ - reinterpret_cast<uintptr_t>(&top) > bytes_;
+    }
+
+private:
+    uintptr_t base_{0};
+    size_t bytes_;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "expr.hpp"
+#include "stmt.hpp"
+
+// What the Compiler and the RegisterCompiler share in compiling statements:
+// showing their results in REPL mode the way Interpreter::execute does,
+// however they are left, and the loops a `break` or a `continue` jumps out
+// of.
+struct StatementCompiler: public Expr::AbstractVisitor, public Stmt::AbstractVisitor
+{
+    StatementCompiler(bool repl_mode);
+
+protected:
+    struct Loop
+    {
+        // Scopes entered outside the loop
+        size_t scopes_;
+
+        // Statements shown around the loop, whose results `break` shows
+        size_t shows_;
+
+        // Those whose results `continue` shows: a for loop's body is shown
+        // with its increment, which `continue` goes on to
+        size_t continueShows_;
+
+        // Jumps to patch once the increment and the end are known
+        std::vector<size_t> continues_;
+        std::vector<size_t> breaks_;
+    };
+
+    bool repl_mode_;
+
+    std::vector<Loop> loops_;
+
+    // Statements of the current function being compiled by statement(),
+    // whose results are shown once they are left, however that happens
+    size_t shows_{0};
+
+    virtual void compile(const StmtPtr& stmt) = 0;
+
+    // Emits the instruction showing the result
+    virtual void emitShow() = 0;
+
+    // Compiles a statement the way Interpreter::execute runs it, showing
+    // its result in REPL mode
+    void statement(const StmtPtr& stmt);
+
+    // Compiles the body of a loop entered with `scopes` scopes, returning it
+    // with the jumps out of it left to patch. The body of a for loop is only
+    // shown by showIncrement(), once its increment has run.
+    Loop loopBody(WhileStmt& stmt, size_t scopes);
+
+    // Shows the body of a for loop, after its increment
+    void showIncrement();
+
+    // Shows the results of the statements a jump out of them leaves, from
+    // the `shows`th on
+    void leaveShows(size_t shows);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "value.hpp"
+#include "heap.hpp"
+
+// Hash for containers keyed by interned strings. Equality is left to the
+// default pointer comparison.
+struct StringHash
+{
+    size_t operator()(LoxString* string) const
+    {
+        return string->hash();
+    }
+};
+
+// Interning table for identifiers and string literals.
+//
+// Every distinct string is stored once, so two interned strings are equal
+// exactly when they are the same object. Interned strings are permanent
+// heap objects: identifiers and literals in the AST refer to them, so they
+// are never collected.
+class StringTable
+{
+public:
+    StringTable(Heap& heap);
+
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+
+    LoxString* intern(std::string_view chars);
+
+    size_t size() const { return count_; }
+
+private:
+    static constexpr size_t INITIAL_CAPACITY = 64;
+
+    Heap& heap_;
+
+    // Open addressing with linear probing; the capacity is a power of two
+    std::vector<LoxString*> entries_;
+    size_t count_{0};
+
+    void grow();
+};
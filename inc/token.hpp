@@ -1,7 +1,6 @@
 #pragma once
 
-#include <memory>
-
+#include "ref.hpp"
 #include "value.hpp"
 
 enum class TokenType
@@ -16,21 +15,24 @@ enum class TokenType
 
     IDENTIFIER, STRING, NUMBER,
 
-    AND, CLASS, ELSE, FALSE, FUN, FOR, IF, NIL, OR,
+    AND, BREAK, CLASS, CONTINUE, ELSE, FALSE, FUN, FOR, IF, NIL, OR,
     PRINT, RETURN, SUPER, THIS, TRUE, VAR, WHILE,
 
     END_OF_FILE,
 };
 
-struct Token {
+struct Token: public RefCounted {
     TokenType tokenType_;
-    LoxValuePtr value_;
+    Value value_;
     std::string lexeme_;
     size_t line_;
 
-    Token(TokenType tokenType, LoxValuePtr value, std::string lexeme, size_t line);
+    // Interned name of an identifier, owned by the interpreter's StringTable
+    LoxString* symbol_{nullptr};
+
+    Token(TokenType tokenType, Value value, std::string lexeme, size_t line);
 
     friend std::ostream& operator<<(std::ostream& out, Token& token);
 };
 
-using TokenPtr = std::shared_ptr<Token>;
+using TokenPtr = Ref<Token>;
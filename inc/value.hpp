@@ -1,62 +1,307 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <string>
-#include <memory>
+#include <string_view>
 
-struct LoxValue
+#include "heap.hpp"
+
+enum class ObjType : uint8_t
+{
+    STRING,
+    INTEGER,
+    FUNCTION,
+    NATIVE,
+    CLASS,
+};
+
+// Base of every heap allocated runtime object. Objects are owned by the Heap
+// and reclaimed by its collector, so a Value refers to one with a bare pointer.
+struct LoxObject: public GcObject
 {
-    friend std::ostream& operator<<(std::ostream& o, LoxValue& value);
+    const ObjType type_;
+
+    LoxObject(ObjType type) : type_{type} {}
+
+    friend std::ostream& operator<<(std::ostream& o, LoxObject& object);
 
     virtual std::ostream& operator<<(std::ostream& o) = 0;
-    virtual ~LoxValue() = default;
+    virtual ~LoxObject() = default;
 };
 
-using LoxValuePtr = std::shared_ptr<LoxValue>;
-
-struct LoxString: public LoxValue
+// A string is one of:
+//  - flat, holding its own characters,
+//  - a rope, the lazy concatenation of two other strings. Ropes make
+//    repeated appends O(1) and are flattened in place the first time their
+//    characters are needed,
+//  - a slice, a window into the characters of a flat string. Slices share
+//    the buffer of their base instead of copying it.
+struct LoxString: public LoxObject
 {
-    std::string value_;
+    static constexpr bool MOVABLE = true;
+
+    // Set for strings owned by a StringTable, which are unique per content
+    bool interned_{false};
 
     LoxString(std::string value);
-    ~LoxString() = default;
+    LoxString(LoxString* left, LoxString* right);
+    LoxString(LoxString* base, size_t offset, size_t length);
+
+    // Concatenations shorter than this are copied instead of building a rope
+    static constexpr size_t MIN_ROPE_LENGTH = 64;
+
+    // Slices shorter than this are copied, so that they don't keep a large
+    // base string alive
+    static constexpr size_t MIN_SLICE_LENGTH = 32;
+
+    bool isRope() const { return left_ != nullptr; }
+    bool isSlice() const { return base_ != nullptr; }
+    size_t length() const { return length_; }
+
+    std::string_view chars()
+    {
+        if (isSlice()) {
+            return std::string_view{base_->chars_}.substr(offset_, length_);
+        }
+
+        if (isRope()) {
+            flatten();
+        }
+        return chars_;
+    }
+
+    // FNV-1a hash of the contents, computed on first use
+    uint32_t hash()
+    {
+        if (!hashed_) {
+            hash_ = hashOf(chars());
+            hashed_ = true;
+        }
+        return hash_;
+    }
+
+    static uint32_t hashOf(std::string_view chars);
 
     std::ostream& operator<<(std::ostream& o) override;
+
+    void trace(Heap& heap) override;
+    size_t footprint() const override;
+    GcObject* relocate(SlabAllocator& allocator) override;
+
+private:
+    std::string chars_;
+    size_t length_;
+
+    // Children of a rope
+    LoxString* left_{nullptr};
+    LoxString* right_{nullptr};
+
+    // Flat string a slice points into
+    LoxString* base_{nullptr};
+    size_t offset_{0};
+
+    bool hashed_{false};
+    uint32_t hash_{0};
+
+    void flatten();
 };
 
-struct LoxInteger: public LoxValue
+// Boxed integer, only used for values that don't fit in the 48 bit payload
+// of a Value.
+struct LoxInteger: public LoxObject
 {
+    static constexpr bool MOVABLE = true;
+
     int64_t value_;
 
     LoxInteger(int64_t value);
-    ~LoxInteger() = default;
 
     std::ostream& operator<<(std::ostream& o) override;
-};
 
-struct LoxFloat: public LoxValue
-{
-    double value_;
+    size_t footprint() const override { return sizeof(LoxInteger); }
 
-    LoxFloat(double value);
-    ~LoxFloat() = default;
+    GcObject* relocate(SlabAllocator& allocator) override
+    {
+        return allocator.make<LoxInteger>(std::move(*this));
+    }
+};
 
-    std::ostream& operator<<(std::ostream& o) override;
+// Number of values handed out by the Value factories, split by whether they
+// were encoded inline or needed a heap box. Every inline value is an
+// allocation that the boxed representation used to make.
+struct ValueStats
+{
+    uint64_t inline_{0};
+    uint64_t boxed_{0};
 };
 
-struct LoxBool: public LoxValue
+// A NaN-boxed 64 bit value.
+//
+// Doubles are stored as they are. Everything else is encoded in the payload
+// of a quiet NaN:
+//
+//   object   1 11111111111 11 00 <48 bit pointer>
+//   integer  0 11111111111 11 10 <48 bit signed integer>
+//   nil      0 11111111111 11 01 ...0001
+//   false    0 11111111111 11 01 ...0010
+//   true     0 11111111111 11 01 ...0011
+//
+// Integers outside the 48 bit range fall back to a boxed LoxInteger.
+class Value
 {
-    bool value_;
+    static constexpr uint64_t SIGN_BIT     = 0x8000000000000000;
+    static constexpr uint64_t QNAN         = 0x7ffc000000000000;
+    static constexpr uint64_t TAG_MASK     = 0x0003000000000000;
+    static constexpr uint64_t TAG_SPECIAL  = 0x0001000000000000;
+    static constexpr uint64_t TAG_INT      = 0x0002000000000000;
+    static constexpr uint64_t PAYLOAD_MASK = 0x0000ffffffffffff;
 
-    LoxBool(bool value);
-    ~LoxBool() = default;
+    static constexpr uint64_t NIL_BITS   = QNAN | TAG_SPECIAL | 1;
+    static constexpr uint64_t FALSE_BITS = QNAN | TAG_SPECIAL | 2;
+    static constexpr uint64_t TRUE_BITS  = QNAN | TAG_SPECIAL | 3;
 
-    std::ostream& operator<<(std::ostream& o) override;
+    static constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000;
+
+    static constexpr int64_t SMALL_INT_MAX = (int64_t{1} << 47) - 1;
+    static constexpr int64_t SMALL_INT_MIN = -(int64_t{1} << 47);
+
+    static ValueStats stats_;
+
+    uint64_t bits_;
+
+    explicit constexpr Value(uint64_t bits, int) : bits_{bits} {}
+
+    static Value boxInteger(int64_t value, Heap& heap);
+
+public:
+    constexpr Value() : bits_{NIL_BITS} {}
+
+    explicit Value(LoxObject* object)
+        : bits_{SIGN_BIT | QNAN | reinterpret_cast<uint64_t>(object)}
+    {}
+
+    // Factories. All runtime values should be created through these so that
+    // the statistics stay meaningful.
+    static Value nil()
+    {
+        ++stats_.inline_;
+        return Value{NIL_BITS, 0};
+    }
+
+    static Value boolean(bool value)
+    {
+        ++stats_.inline_;
+        return Value{value ? TRUE_BITS : FALSE_BITS, 0};
+    }
+
+    static Value integer(int64_t value, Heap& heap)
+    {
+        if (value < SMALL_INT_MIN || value > SMALL_INT_MAX) {
+            return boxInteger(value, heap);
+        }
+        ++stats_.inline_;
+        return Value{QNAN | TAG_INT | (static_cast<uint64_t>(value) & PAYLOAD_MASK), 0};
+    }
+
+    // Integer literal from the source. The AST keeps referring to it, so a
+    // boxed one is allocated as a permanent object.
+    static Value integerConstant(int64_t value, Heap& heap);
+
+    static Value number(double value)
+    {
+        ++stats_.inline_;
+
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        if (value != value) {
+            bits = CANONICAL_NAN;
+        }
+
+        return Value{bits, 0};
+    }
+
+    bool isNil() const { return bits_ == NIL_BITS; }
+    bool isBool() const { return (bits_ | 1) == TRUE_BITS; }
+    bool isObject() const { return (bits_ & (SIGN_BIT | QNAN)) == (SIGN_BIT | QNAN); }
+    bool isSmallInt() const { return (bits_ & (SIGN_BIT | QNAN | TAG_MASK)) == (QNAN | TAG_INT); }
+    bool isFloat() const { return (bits_ & QNAN) != QNAN; }
+
+    bool isObjType(ObjType type) const { return isObject() && asObject()->type_ == type; }
+
+    bool isInt() const { return isSmallInt() || isObjType(ObjType::INTEGER); }
+    bool isNum() const { return isFloat() || isInt(); }
+    bool isString() const { return isObjType(ObjType::STRING); }
+    bool isCallable() const { return isObjType(ObjType::FUNCTION) || isObjType(ObjType::NATIVE); }
+
+    bool asBool() const { return bits_ == TRUE_BITS; }
+
+    LoxObject* asObject() const
+    {
+        return reinterpret_cast<LoxObject*>(bits_ & PAYLOAD_MASK);
+    }
+
+    template <typename T>
+    T* as() const
+    {
+        return static_cast<T*>(asObject());
+    }
+
+    int64_t asSmallInt() const
+    {
+        return static_cast<int64_t>(bits_ << 16) >> 16;
+    }
+
+    int64_t asInt() const
+    {
+        if (isSmallInt()) {
+            return asSmallInt();
+        }
+        return as<LoxInteger>()->value_;
+    }
+
+    double asDouble() const
+    {
+        double value;
+        std::memcpy(&value, &bits_, sizeof(value));
+        return value;
+    }
+
+    // Numeric value as a double, converting integers.
+    double asFloat() const
+    {
+        if (isFloat()) {
+            return asDouble();
+        }
+        return static_cast<double>(asInt());
+    }
+
+    static const ValueStats& stats() { return stats_; }
+
+    friend std::ostream& operator<<(std::ostream& o, const Value& value);
 };
 
-struct LoxNil: public LoxValue
+// Only the generational part: the snapshot barrier is up to the writer,
+// which has to shade the overwritten value under a GcLock
+inline void Heap::writeBarrier(GcObject* owner, const Value& value)
 {
-    ~LoxNil() = default;
+    if (value.isObject() && value.asObject()->young_ && !owner->young_) {
+        remember(owner);
+    }
+}
 
-    std::ostream& operator<<(std::ostream& o) override;
-};
+inline void Heap::store(GcObject* owner, Value& slot, const Value& value)
+{
+    writeBarrier(owner, value);
+
+    if (!marking_) {
+        slot = value;
+        return;
+    }
+
+    GcLock lock{owner};
 
+    shadeObject(slot);
+    slot = value;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "chunk.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+#include "vm_stack.hpp"
+
+// Stack based virtual machine running the bytecode from Compiler.
+//
+// It shares the interpreter's heap, globals and result_, and runs the same
+// LoxFunction closures, but keeps its own value stack, which the dispatch
+// loop addresses through raw pointers: it only grows when a call needs more
+// slots than there are, rebasing every pointer into it. Frames live on that
+// stack as they do on the interpreter's, the callee right below its
+// arguments and locals, and calls past `maxDepth`, or needing more than
+// `maxStackSlots`, fail with a "Stack overflow." runtime error. Collections
+// happen when a call is made and on loop back edges, with every value the
+// code holds on the stack.
+class VM: public GcRoots
+{
+public:
+    static constexpr size_t INITIAL_STACK_SLOTS = 64 * 1024;
+    static constexpr size_t DEFAULT_MAX_STACK_SLOTS = 16 * 1024 * 1024;
+
+    VM(Interpreter& interpreter, size_t maxDepth, size_t maxStackSlots = DEFAULT_MAX_STACK_SLOTS);
+    ~VM();
+
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    void interpret(const std::vector<StmtPtr>& statements);
+
+    void markRoots(Heap& heap) override;
+
+private:
+    struct CallFrame
+    {
+        // Null for top-level code
+        LoxFunction* function_;
+        Chunk* chunk_;
+
+        // Where the code goes on once the callee returns
+        const uint8_t* ip_;
+        Value* slots_;
+    };
+
+    Interpreter& interpreter_;
+    Compiler compiler_;
+
+    size_t maxDepth_;
+
+    VMStack stack_;
+    Value* sp_{nullptr};
+
+    std::vector<CallFrame> frames_;
+
+    void run();
+
+    // Makes room for these many slots, rebasing sp_ and the frames; false
+    // past `maxStackSlots`
+    bool growStack(size_t slots);
+
+    // Drops whatever was running when a runtime error was raised
+    void reset();
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "environment.hpp"
+#include "heap.hpp"
+#include "value.hpp"
+
+// Value stack of the VM and the RegisterVM, which their frames live on, with
+// the upvalues still referring to its slots.
+//
+// Their dispatch loops address it through raw pointers, so it only grows when
+// a call needs more slots than there are, up to `maxSlots`, and growing it
+// rebases every pointer the VM holds into it.
+class VMStack
+{
+public:
+    VMStack(Heap& heap, size_t maxSlots);
+
+    Value* data() { return slots_.data(); }
+    size_t size() const { return slots_.size(); }
+
+    // Makes room for these many slots; false past the maximum. `pointers` is
+    // called with a function taking a Value*&, to pass it every pointer into
+    // the stack that must follow it when it moves.
+    template <typename Pointers>
+    bool grow(size_t slots, Pointers pointers);
+
+    Upvalue* captureUpvalue(Value* slot) { return openUpvalues_.capture(slot - data()); }
+
+    // Closes the open upvalues from `from` onwards, as the variables there go
+    // out of scope
+    void closeUpvalues(Value* from) { openUpvalues_.close(from - data()); }
+
+    // Marks the open upvalues, and the slots below `top`
+    void markRoots(Heap& heap, Value* top);
+
+private:
+    size_t maxSlots_;
+    std::vector<Value> slots_;
+    OpenUpvalues openUpvalues_;
+};
+
+template <typename Pointers>
+bool VMStack::grow(size_t slots, Pointers pointers)
+{
+    if (slots <= slots_.size()) {
+        return true;
+    }
+
+    if (slots > maxSlots_) {
+        return false;
+    }
+
+    // The pointers are rebased by their index
+    std::vector<size_t> indices;
+    pointers([&](Value*& pointer) { indices.push_back(pointer - slots_.data()); });
+
+    slots_.resize(std::min(std::max(slots, 2 * slots_.size()), maxSlots_));
+
+    auto index = indices.begin();
+    pointers([&](Value*& pointer) { pointer = slots_.data() + *index++; });
+    return true;
+}
@@ -0,0 +1,24 @@
+#include "call_cache.hpp"
+
+#include "function.hpp"
+
+CallCacheStats CallCache::stats_;
+
+CallCache::Entry CallCache::insert(LoxCallable* callee)
+{
+    Entry entry{callee};
+
+    if (callee->type_ == ObjType::FUNCTION) {
+        entry.function_ = static_cast<LoxFunction*>(callee);
+    } else {
+        entry.native_ = static_cast<LoxNative*>(callee);
+    }
+
+    if (size_ < ENTRIES) {
+        entries_[size_++] = entry;
+    } else {
+        ++stats_.megamorphic_;
+    }
+
+    return entry;
+}
@@ -0,0 +1,722 @@
+#include "closure_compiler.hpp"
+
+#include <functional>
+#include <iostream>
+
+#include "function.hpp"
+#include "lox_class.hpp"
+#include "lox_exception.hpp"
+#include "stack_limit.hpp"
+
+namespace
+{
+    // Whether evaluating the expression may run statements, and so reach a
+    // safepoint that can move the values held meanwhile
+    bool reachesSafepoint(const Expr* expr)
+    {
+        if (dynamic_cast<const CallExpr*>(expr)) {
+            return true;
+        }
+
+        if (auto assign = dynamic_cast<const AssignExpr*>(expr)) {
+            return reachesSafepoint(assign->value_.get());
+        }
+
+        if (auto binary = dynamic_cast<const BinaryExpr*>(expr)) {
+            return reachesSafepoint(binary->left_.get()) || reachesSafepoint(binary->right_.get());
+        }
+
+        if (auto logical = dynamic_cast<const LogicalExpr*>(expr)) {
+            return reachesSafepoint(logical->left_.get()) || reachesSafepoint(logical->right_.get());
+        }
+
+        if (auto unary = dynamic_cast<const UnaryExpr*>(expr)) {
+            return reachesSafepoint(unary->right_.get());
+        }
+
+        if (auto grouping = dynamic_cast<const GroupingExpr*>(expr)) {
+            return reachesSafepoint(grouping->expression_.get());
+        }
+
+        return false;
+    }
+
+    // Operands of the same representation are handled inline, anything else
+    // (and every error) the way the interpreter does
+    template <typename Op>
+    auto arithmetic(Interpreter& interpreter, TokenPtr op)
+    {
+        return [&interpreter, op = std::move(op)](const Value& left, const Value& right) {
+            if (left.isSmallInt() && right.isSmallInt()) {
+                return Value::integer(Op{}(left.asSmallInt(), right.asSmallInt()), interpreter.heap_);
+            }
+
+            if (left.isFloat() && right.isFloat()) {
+                return Value::number(Op{}(left.asDouble(), right.asDouble()));
+            }
+
+            interpreter.applyBinary(op, left, right);
+            return interpreter.result_;
+        };
+    }
+
+    template <typename Op>
+    auto comparison(Interpreter& interpreter, TokenPtr op)
+    {
+        return [&interpreter, op = std::move(op)](const Value& left, const Value& right) {
+            if (left.isSmallInt() && right.isSmallInt()) {
+                return Value::boolean(Op{}(left.asSmallInt(), right.asSmallInt()));
+            }
+
+            if (left.isFloat() && right.isFloat()) {
+                return Value::boolean(Op{}(left.asDouble(), right.asDouble()));
+            }
+
+            interpreter.applyBinary(op, left, right);
+            return interpreter.result_;
+        };
+    }
+
+    template <typename Apply>
+    ExprCode binary(Interpreter& interpreter, ExprCode left, ExprCode right, bool spill, Apply apply)
+    {
+        if (!spill) {
+            return [left = std::move(left), right = std::move(right), apply = std::move(apply)] {
+                auto l = left();
+                return apply(l, right());
+            };
+        }
+
+        // Evaluating the right operand may reach a safepoint, which can move
+        // the left one; it is kept on the stack and reloaded afterwards
+        return [&stack = interpreter.stack_, left = std::move(left), right = std::move(right), apply = std::move(apply)] {
+            stack.push_back(left());
+            auto r = right();
+            auto l = stack.back();
+            stack.pop_back();
+
+            return apply(l, r);
+        };
+    }
+}
+
+ClosureCompiler::ClosureCompiler(Interpreter& interpreter, size_t maxDepth)
+    : interpreter_{interpreter}
+    , maxDepth_{maxDepth}
+    , stack_{stackBudget()}
+{ }
+
+void ClosureCompiler::interpret(const std::vector<StmtPtr>& statements)
+{
+    std::vector<StmtCode> code;
+    code.reserve(statements.size());
+
+    stack_.start();
+
+    try {
+        for (const auto& statement: statements) {
+            code.push_back(this->statement(statement));
+        }
+    } catch (compile_error& error) {
+        std::cerr << "Compile error: " << error.what() << std::endl;
+        return;
+    }
+
+    try {
+        for (const auto& statement: code) {
+            interpreter_.heap_.safepoint();
+            statement();
+        }
+    } catch (interpreter_error& error) {
+        depth_ = 0;
+        interpreter_.abort(error);
+    }
+}
+
+ExprCode ClosureCompiler::compile(const ExprPtr& expr)
+{
+    checkNesting();
+    expr->accept(*this);
+    return std::move(expr_);
+}
+
+StmtCode ClosureCompiler::compile(const StmtPtr& stmt)
+{
+    checkNesting();
+    stmt->accept(*this);
+    return std::move(stmt_);
+}
+
+void ClosureCompiler::checkNesting() const
+{
+    // Left-associative chains such as `1 + 1 + ...` nest without limit from
+    // the parser
+    if (stack_.exceeded()) {
+        throw compile_error{"Too deeply nested."};
+    }
+}
+
+StmtCode ClosureCompiler::statement(const StmtPtr& stmt)
+{
+    auto code = compile(stmt);
+
+    if (!interpreter_.repl_mode_) {
+        return code;
+    }
+
+    return [&result = interpreter_.result_, code = std::move(code)] {
+        auto completion = code();
+        std::cout << result << std::endl;
+
+        return completion;
+    };
+}
+
+ExprCode ClosureCompiler::condition(const ExprPtr& expr)
+{
+    auto code = compile(expr);
+
+    if (!interpreter_.repl_mode_) {
+        return code;
+    }
+
+    return [&result = interpreter_.result_, code = std::move(code)] {
+        result = code();
+        return result;
+    };
+}
+
+StmtCode ClosureCompiler::sequence(const std::vector<StmtPtr>& statements)
+{
+    std::vector<StmtCode> code;
+    code.reserve(statements.size());
+
+    for (const auto& stmt: statements) {
+        code.push_back(compile(stmt));
+    }
+
+    return [&heap = interpreter_.heap_, code = std::move(code)] {
+        for (const auto& statement: code) {
+            heap.safepoint();
+            auto completion = statement();
+
+            if (completion != Completion::NORMAL) return completion;
+        }
+
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitAssignExpr(AssignExprPtr expr)
+{
+    auto value = compile(expr->value_);
+
+    if (expr->slot_ >= 0) {
+        expr_ = [&stack = interpreter_.stack_, &frame = interpreter_.frame_, slot = expr->slot_, value = std::move(value)] {
+            auto v = value();
+            stack[frame + slot] = v;
+            return v;
+        };
+    } else if (expr->upvalue_ >= 0) {
+        expr_ = [&function = interpreter_.function_, index = expr->upvalue_, value = std::move(value)] {
+            auto v = value();
+            function->upvalue(index)->set(v);
+            return v;
+        };
+    } else {
+        expr_ = [&global = interpreter_.global_, name = expr->name_, cell = static_cast<GlobalCell*>(nullptr), value = std::move(value)]() mutable {
+            auto v = value();
+            global.assign(name, cell, v);
+            return v;
+        };
+    }
+}
+
+void ClosureCompiler::visitBinaryExpr(BinaryExprPtr expr)
+{
+    auto& interpreter = interpreter_;
+    auto left = compile(expr->left_);
+    auto right = compile(expr->right_);
+    auto spill = reachesSafepoint(expr->right_.get());
+    auto op = expr->op_;
+
+    switch (op->tokenType_) {
+        case TokenType::PLUS:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, arithmetic<std::plus<>>(interpreter, op));
+            break;
+        case TokenType::MINUS:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, arithmetic<std::minus<>>(interpreter, op));
+            break;
+        case TokenType::STAR:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, arithmetic<std::multiplies<>>(interpreter, op));
+            break;
+        case TokenType::GREATER:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, comparison<std::greater<>>(interpreter, op));
+            break;
+        case TokenType::GREATER_EQUAL:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, comparison<std::greater_equal<>>(interpreter, op));
+            break;
+        case TokenType::LESS:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, comparison<std::less<>>(interpreter, op));
+            break;
+        case TokenType::LESS_EQUAL:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, comparison<std::less_equal<>>(interpreter, op));
+            break;
+        case TokenType::EQUAL_EQUAL:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, [&interpreter](const Value& l, const Value& r) {
+                return Value::boolean(interpreter.isEqual(l, r));
+            });
+            break;
+        case TokenType::BANG_EQUAL:
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, [&interpreter](const Value& l, const Value& r) {
+                return Value::boolean(!interpreter.isEqual(l, r));
+            });
+            break;
+        default:
+            // Division by zero is checked by the interpreter
+            expr_ = binary(interpreter, std::move(left), std::move(right), spill, [&interpreter, op](const Value& l, const Value& r) {
+                interpreter.applyBinary(op, l, r);
+                return interpreter.result_;
+            });
+            break;
+    }
+}
+
+void ClosureCompiler::visitGroupingExpr(GroupingExprPtr expr)
+{
+    expr_ = compile(expr->expression_);
+}
+
+void ClosureCompiler::visitLiteralExpr(LiteralExprPtr expr)
+{
+    expr_ = [value = expr->value_] { return value; };
+}
+
+void ClosureCompiler::visitUnaryExpr(UnaryExprPtr expr)
+{
+    auto right = compile(expr->right_);
+
+    if (expr->op_->tokenType_ == TokenType::BANG) {
+        expr_ = [&interpreter = interpreter_, right = std::move(right)] {
+            return Value::boolean(!interpreter.isTruthy(right()));
+        };
+        return;
+    }
+
+    expr_ = [&interpreter = interpreter_, op = expr->op_, right = std::move(right)] {
+        auto value = right();
+
+        if (value.isSmallInt()) {
+            return Value::integer(-value.asSmallInt(), interpreter.heap_);
+        }
+
+        if (value.isFloat()) {
+            return Value::number(-value.asDouble());
+        }
+
+        interpreter.applyUnary(op, value);
+        return interpreter.result_;
+    };
+}
+
+void ClosureCompiler::visitVariableExpr(VariableExprPtr expr)
+{
+    if (expr->slot_ >= 0) {
+        expr_ = [&stack = interpreter_.stack_, &frame = interpreter_.frame_, slot = expr->slot_] {
+            return stack[frame + slot];
+        };
+    } else if (expr->upvalue_ >= 0) {
+        expr_ = [&function = interpreter_.function_, index = expr->upvalue_] {
+            return function->upvalue(index)->get();
+        };
+    } else {
+        expr_ = [&global = interpreter_.global_, name = expr->name_, cell = static_cast<GlobalCell*>(nullptr)]() mutable {
+            return global.get(name, cell);
+        };
+    }
+}
+
+void ClosureCompiler::visitLogicalExpr(LogicalExprPtr expr)
+{
+    auto left = compile(expr->left_);
+    auto right = compile(expr->right_);
+
+    if (expr->op_->tokenType_ == TokenType::OR) {
+        expr_ = [&interpreter = interpreter_, left = std::move(left), right = std::move(right)] {
+            auto value = left();
+            return interpreter.isTruthy(value) ? value : right();
+        };
+    } else {
+        expr_ = [&interpreter = interpreter_, left = std::move(left), right = std::move(right)] {
+            auto value = left();
+            return interpreter.isTruthy(value) ? right() : value;
+        };
+    }
+}
+
+void ClosureCompiler::visitCallExpr(CallExprPtr expr)
+{
+    auto callee = compile(expr->callee_);
+    std::vector<ExprCode> args;
+
+    for (const auto& arg: expr->args_) {
+        args.push_back(compile(arg));
+    }
+
+    // The code never outlives the AST the call is part of, nor therefore the
+    // call site's cache
+    expr_ = [this, callee = std::move(callee), args = std::move(args), paren = expr->paren_, cache = &expr->cache_] {
+        auto base = prepareCall(callee, args);
+        auto entry = interpreter_.checkCallee(*cache, paren, interpreter_.stack_[base], args.size());
+        return finishCall(base, entry, paren);
+    };
+}
+
+void ClosureCompiler::visitWhileStmt(WhileStmtPtr stmt)
+{
+    auto condition = this->condition(stmt->condition_);
+    auto body = stmt->increment_ ? compile(stmt->statements_) : statement(stmt->statements_);
+    auto increment = stmt->increment_ ? compile(stmt->increment_) : ExprCode{};
+
+    // The body of a for loop is shown with its increment, after it runs, or
+    // as it is left by anything but `continue`
+    if (increment && interpreter_.repl_mode_) {
+        body = [&result = interpreter_.result_, body = std::move(body)] {
+            auto completion = body();
+
+            if (completion != Completion::NORMAL && completion != Completion::CONTINUE) {
+                std::cout << result << std::endl;
+            }
+            return completion;
+        };
+
+        increment = [&result = interpreter_.result_, increment = std::move(increment)] {
+            result = increment();
+            std::cout << result << std::endl;
+
+            return result;
+        };
+    }
+
+    stmt_ = [&interpreter = interpreter_, condition = std::move(condition), body = std::move(body), increment = std::move(increment)] {
+        while (interpreter.isTruthy(condition())) {
+            auto completion = body();
+
+            if (completion == Completion::BREAK) break;
+            if (completion != Completion::NORMAL && completion != Completion::CONTINUE) return completion;
+
+            if (increment) {
+                increment();
+            }
+
+            interpreter.heap_.safepoint();
+        }
+
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitIfStmt(IfStmtPtr stmt)
+{
+    auto condition = this->condition(stmt->condition_);
+    auto thenCode = statement(stmt->thenStmt_);
+
+    if (!stmt->elseStmt_) {
+        stmt_ = [&interpreter = interpreter_, condition = std::move(condition), thenCode = std::move(thenCode)] {
+            return interpreter.isTruthy(condition()) ? thenCode() : Completion::NORMAL;
+        };
+        return;
+    }
+
+    auto elseCode = statement(stmt->elseStmt_);
+
+    stmt_ = [&interpreter = interpreter_, condition = std::move(condition), thenCode = std::move(thenCode), elseCode = std::move(elseCode)] {
+        return interpreter.isTruthy(condition()) ? thenCode() : elseCode();
+    };
+}
+
+void ClosureCompiler::visitBlockStmt(BlockStmtPtr stmt)
+{
+    auto body = sequence(stmt->statements_);
+    auto closeFrom = stmt->closeFrom_;
+
+    if (stmt->scopeSize_ == 0) {
+        // Its variables, if any, live in the current frame
+        if (closeFrom < 0) {
+            stmt_ = std::move(body);
+            return;
+        }
+
+        stmt_ = [&interpreter = interpreter_, body = std::move(body), closeFrom] {
+            auto completion = body();
+            interpreter.openUpvalues_.close(interpreter.frame_ + closeFrom);
+
+            return completion;
+        };
+        return;
+    }
+
+    stmt_ = [&interpreter = interpreter_, body = std::move(body), size = stmt->scopeSize_, closeFrom] {
+        auto& stack = interpreter.stack_;
+        auto base = stack.size();
+        auto enclosing = interpreter.frame_;
+
+        stack.resize(base + size, Value::nil());
+        interpreter.frame_ = base;
+
+        auto completion = body();
+
+        if (closeFrom >= 0) {
+            interpreter.openUpvalues_.close(base + closeFrom);
+        }
+
+        interpreter.frame_ = enclosing;
+        stack.resize(base);
+
+        return completion;
+    };
+}
+
+void ClosureCompiler::visitExpressionStmt(ExpressionStmtPtr stmt)
+{
+    auto expression = compile(stmt->expression_);
+
+    // Only the REPL shows the value
+    if (!interpreter_.repl_mode_) {
+        stmt_ = [expression = std::move(expression)] {
+            expression();
+            return Completion::NORMAL;
+        };
+        return;
+    }
+
+    stmt_ = [&result = interpreter_.result_, expression = std::move(expression)] {
+        result = expression();
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitPrintStmt(PrintStmtPtr stmt)
+{
+    stmt_ = [&result = interpreter_.result_, expression = compile(stmt->expression_)] {
+        result = expression();
+        std::cout << result << std::endl;
+
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitVarStmt(VarStmtPtr stmt)
+{
+    auto initializer = stmt->initializer_ ? compile(stmt->initializer_) : [] { return Value::nil(); };
+
+    // Like the interpreter, only an initializer is a result
+    auto show = interpreter_.repl_mode_ && stmt->initializer_;
+
+    if (stmt->slot_ >= 0) {
+        stmt_ = [&interpreter = interpreter_, slot = stmt->slot_, show, initializer = std::move(initializer)] {
+            auto value = initializer();
+            interpreter.stack_[interpreter.frame_ + slot] = value;
+
+            if (show) {
+                interpreter.result_ = value;
+            }
+            return Completion::NORMAL;
+        };
+    } else {
+        stmt_ = [&interpreter = interpreter_, name = stmt->name_->symbol_, show, initializer = std::move(initializer)] {
+            auto value = initializer();
+            interpreter.global_.define(name, value);
+
+            if (show) {
+                interpreter.result_ = value;
+            }
+            return Completion::NORMAL;
+        };
+    }
+}
+
+void ClosureCompiler::visitFunctionStmt(FunctionStmtPtr stmt)
+{
+    if (!stmt->closureCode_) {
+        // The body is only reached through calls, in the function's frame
+        std::vector<StmtCode> body;
+
+        for (const auto& statement: stmt->body_) {
+            body.push_back(compile(statement));
+        }
+
+        stmt->closureCode_ = makeRef<ClosureCode>();
+        stmt->closureCode_->body_ = [&heap = interpreter_.heap_, body = std::move(body)] {
+            for (const auto& statement: body) {
+                heap.safepoint();
+                auto completion = statement();
+
+                if (completion != Completion::NORMAL) return completion;
+            }
+
+            return Completion::NORMAL;
+        };
+    }
+
+    stmt_ = [&interpreter = interpreter_, stmt = stmt.get()] {
+        std::vector<Upvalue*> upvalues;
+        upvalues.reserve(stmt->captures_.size());
+
+        for (const auto& capture: stmt->captures_) {
+            upvalues.push_back(capture.local_ ? interpreter.openUpvalues_.capture(interpreter.frame_ + capture.index_)
+                                              : interpreter.function_->upvalue(capture.index_));
+        }
+
+        interpreter.declare(stmt->slot_, stmt->name_, Value{interpreter.heap_.make<LoxFunction>(FunctionStmtPtr{stmt}, std::move(upvalues))});
+        return Completion::NORMAL;
+    };
+}
+
+void ClosureCompiler::visitReturnStmt(ReturnStmtPtr stmt)
+{
+    auto& result = interpreter_.result_;
+
+    if (stmt->tailCall_) {
+        auto& call = static_cast<CallExpr&>(*stmt->value_);
+        auto callee = compile(call.callee_);
+        std::vector<ExprCode> args;
+
+        for (const auto& arg: call.args_) {
+            args.push_back(compile(arg));
+        }
+
+        stmt_ = [this, callee = std::move(callee), args = std::move(args), paren = call.paren_, cache = &call.cache_] {
+            auto& stack = interpreter_.stack_;
+            auto base = prepareCall(callee, args);
+            auto entry = interpreter_.checkCallee(*cache, paren, stack[base], args.size());
+
+            // The interpreter shows the last argument it evaluated, or the
+            // callee if there are none
+            if (interpreter_.repl_mode_) {
+                interpreter_.result_ = stack.back();
+            }
+
+            // Left for the caller to make, in the frame being left
+            if (entry.function_) {
+                interpreter_.tailCall_.assign(stack.begin() + base, stack.end());
+                stack.resize(base);
+
+                return Completion::TAIL_CALL;
+            }
+
+            interpreter_.result_ = finishCall(base, entry, paren);
+            return Completion::RETURN;
+        };
+    } else if (stmt->value_) {
+        stmt_ = [&result, value = compile(stmt->value_)] {
+            result = value();
+            return Completion::RETURN;
+        };
+    } else {
+        stmt_ = [&result] {
+            result = Value::nil();
+            return Completion::RETURN;
+        };
+    }
+}
+
+void ClosureCompiler::visitBreakStmt(BreakStmtPtr)
+{
+    stmt_ = [] { return Completion::BREAK; };
+}
+
+void ClosureCompiler::visitContinueStmt(ContinueStmtPtr)
+{
+    stmt_ = [] { return Completion::CONTINUE; };
+}
+
+void ClosureCompiler::visitClassStmt(ClassStmtPtr stmt)
+{
+    stmt_ = [&interpreter = interpreter_, slot = stmt->slot_, name = stmt->name_] {
+        interpreter.declare(slot, name, Value{interpreter.heap_.make<LoxClass>(name->lexeme_)});
+        return Completion::NORMAL;
+    };
+}
+
+size_t ClosureCompiler::prepareCall(const ExprCode& callee, const std::vector<ExprCode>& args)
+{
+    // The callee and the arguments are kept on the stack for the duration of
+    // the call, so that neither is collected while the others are evaluated
+    // or while the call runs
+    auto& stack = interpreter_.stack_;
+    auto base = stack.size();
+
+    stack.push_back(callee());
+
+    for (const auto& arg: args) {
+        stack.push_back(arg());
+    }
+
+    return base;
+}
+
+Value ClosureCompiler::finishCall(size_t base, const CallCache::Entry& callee, const TokenPtr& paren)
+{
+    auto& stack = interpreter_.stack_;
+    Value result;
+
+    if (callee.function_) {
+        result = call(callee.function_, base + 1, paren);
+    } else {
+        try {
+            result = callee.native_->call(interpreter_, std::span<Value>{stack}.subspan(base + 1));
+        } catch (native_error& error) {
+            throw interpreter_error{paren, error.what()};
+        }
+    }
+
+    stack.resize(base);
+    return result;
+}
+
+Value ClosureCompiler::call(LoxFunction* function, size_t frame, const TokenPtr& paren)
+{
+    if (depth_ == maxDepth_ || stack_.exceeded()) {
+        throw interpreter_error{paren, "Stack overflow."};
+    }
+    ++depth_;
+
+    auto& interpreter = interpreter_;
+    auto& stack = interpreter.stack_;
+    auto enclosingFunction = interpreter.function_;
+    auto enclosingFrame = interpreter.frame_;
+
+    // The function being run sits right below its frame, where it stays
+    // reachable even once it has been reached through a tail call
+    for (;;) {
+        auto& declaration = *function->declaration();
+
+        stack.resize(frame + declaration.scopeSize_, Value::nil());
+        interpreter.frame_ = frame;
+        interpreter.function_ = function;
+
+        auto completion = declaration.closureCode_->body_();
+
+        if (declaration.closeFrom_ >= 0) {
+            interpreter.openUpvalues_.close(frame + declaration.closeFrom_);
+        }
+
+        stack.resize(frame);
+
+        if (completion != Completion::TAIL_CALL) {
+            interpreter.function_ = enclosingFunction;
+            interpreter.frame_ = enclosingFrame;
+            --depth_;
+
+            return completion == Completion::RETURN ? interpreter.result_ : Value::nil();
+        }
+
+        auto& tailCall = interpreter.tailCall_;
+
+        function = tailCall.front().as<LoxFunction>();
+        stack[frame - 1] = tailCall.front();
+        stack.insert(stack.end(), tailCall.begin() + 1, tailCall.end());
+        tailCall.clear();
+    }
+}
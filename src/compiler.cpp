@@ -0,0 +1,524 @@
+#include "compiler.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "lox_exception.hpp"
+
+namespace
+{
+    constexpr size_t MAX_OPERAND = std::numeric_limits<uint16_t>::max();
+
+    template <typename T>
+    uint16_t add(std::vector<T>& pool, T entry, const char* what)
+    {
+        if (pool.size() > MAX_OPERAND) {
+            throw compile_error{std::string{"Too many "} + what + " in one function."};
+        }
+
+        pool.push_back(std::move(entry));
+        return pool.size() - 1;
+    }
+
+    OpCode binaryOp(TokenType type)
+    {
+        switch (type) {
+            case TokenType::EQUAL_EQUAL: return OpCode::EQUAL;
+            case TokenType::BANG_EQUAL: return OpCode::NOT_EQUAL;
+            case TokenType::GREATER: return OpCode::GREATER;
+            case TokenType::GREATER_EQUAL: return OpCode::GREATER_EQUAL;
+            case TokenType::LESS: return OpCode::LESS;
+            case TokenType::LESS_EQUAL: return OpCode::LESS_EQUAL;
+            case TokenType::PLUS: return OpCode::ADD;
+            case TokenType::MINUS: return OpCode::SUBTRACT;
+            case TokenType::STAR: return OpCode::MULTIPLY;
+            case TokenType::SLASH: return OpCode::DIVIDE;
+            default: throw compile_error{"Unknown binary operator."};
+        }
+    }
+}
+
+Compiler::Compiler(bool repl_mode)
+    : StatementCompiler{repl_mode}
+{ }
+
+ChunkPtr Compiler::compile(const std::vector<StmtPtr>& statements)
+{
+    auto script = makeRef<Chunk>();
+
+    chunk_ = script.get();
+    depth_ = 0;
+    slotBase_ = 0;
+    scopes_.clear();
+    loops_.clear();
+    shows_ = 0;
+
+    for (const auto& stmt: statements) {
+        statement(stmt);
+    }
+    emit(OpCode::RETURN_NIL, 0);
+
+    chunk_ = nullptr;
+    return script;
+}
+
+void Compiler::compile(const StmtPtr& stmt)
+{
+    stmt->accept(*this);
+}
+
+void Compiler::compile(const ExprPtr& expr)
+{
+    expr->accept(*this);
+}
+
+void Compiler::emitShow()
+{
+    emit(OpCode::SHOW, 0);
+}
+
+void Compiler::condition(const ExprPtr& expr)
+{
+    compile(expr);
+
+    if (repl_mode_) {
+        emit(OpCode::RESULT, 0);
+    }
+}
+
+void Compiler::visitAssignExpr(AssignExprPtr expr)
+{
+    compile(expr->value_);
+
+    if (expr->slot_ >= 0) {
+        emit(OpCode::SET_LOCAL, 0);
+        emitShort(slot(expr->slot_));
+    } else if (expr->upvalue_ >= 0) {
+        emit(OpCode::SET_UPVALUE, 0);
+        emitShort(expr->upvalue_);
+    } else {
+        emit(OpCode::SET_GLOBAL, 0);
+        emitShort(global(expr->name_));
+    }
+}
+
+void Compiler::visitBinaryExpr(BinaryExprPtr expr)
+{
+    compile(expr->left_);
+    compile(expr->right_);
+
+    auto op = binaryOp(expr->op_->tokenType_);
+    emit(op, -1);
+
+    // Only equality can't fail
+    if (op != OpCode::EQUAL && op != OpCode::NOT_EQUAL) {
+        emitShort(token(expr->op_));
+    }
+}
+
+void Compiler::visitGroupingExpr(GroupingExprPtr expr)
+{
+    compile(expr->expression_);
+}
+
+void Compiler::visitLiteralExpr(LiteralExprPtr expr)
+{
+    if (expr->value_.isNil()) {
+        emit(OpCode::NIL, 1);
+        return;
+    }
+
+    emit(OpCode::CONSTANT, 1);
+    emitShort(constant(expr->value_));
+}
+
+void Compiler::visitUnaryExpr(UnaryExprPtr expr)
+{
+    compile(expr->right_);
+
+    if (expr->op_->tokenType_ == TokenType::BANG) {
+        emit(OpCode::NOT, 0);
+    } else {
+        emit(OpCode::NEGATE, 0);
+        emitShort(token(expr->op_));
+    }
+}
+
+void Compiler::visitVariableExpr(VariableExprPtr expr)
+{
+    if (expr->slot_ >= 0) {
+        emit(OpCode::GET_LOCAL, 1);
+        emitShort(slot(expr->slot_));
+    } else if (expr->upvalue_ >= 0) {
+        emit(OpCode::GET_UPVALUE, 1);
+        emitShort(expr->upvalue_);
+    } else {
+        emit(OpCode::GET_GLOBAL, 1);
+        emitShort(global(expr->name_));
+    }
+}
+
+void Compiler::visitLogicalExpr(LogicalExprPtr expr)
+{
+    compile(expr->left_);
+
+    // The left operand is the result if it decides it, else it is dropped
+    // for the right one
+    auto end = emitJump(expr->op_->tokenType_ == TokenType::OR ? OpCode::JUMP_IF_TRUE : OpCode::JUMP_IF_FALSE, 0);
+
+    emit(OpCode::POP, -1);
+    compile(expr->right_);
+
+    patchJump(end);
+}
+
+void Compiler::visitCallExpr(CallExprPtr expr)
+{
+    compile(expr->callee_);
+
+    for (const auto& arg: expr->args_) {
+        compile(arg);
+    }
+
+    emit(OpCode::CALL, -static_cast<int>(expr->args_.size()));
+    emitByte(expr->args_.size());
+    emitShort(token(expr->paren_));
+}
+
+void Compiler::visitWhileStmt(WhileStmtPtr stmt)
+{
+    auto start = chunk_->code_.size();
+
+    condition(stmt->condition_);
+    auto exit = emitJump(OpCode::POP_JUMP_IF_FALSE, -1);
+
+    auto loop = loopBody(*stmt, scopes_.size());
+
+    for (auto jump: loop.continues_) {
+        patchJump(jump);
+    }
+
+    if (stmt->increment_) {
+        compile(stmt->increment_);
+        emit(OpCode::POP_RESULT, -1);
+        showIncrement();
+    }
+
+    emitLoop(start);
+
+    patchJump(exit);
+
+    for (auto jump: loop.breaks_) {
+        patchJump(jump);
+    }
+}
+
+void Compiler::visitIfStmt(IfStmtPtr stmt)
+{
+    condition(stmt->condition_);
+    auto otherwise = emitJump(OpCode::POP_JUMP_IF_FALSE, -1);
+
+    statement(stmt->thenStmt_);
+
+    if (stmt->elseStmt_) {
+        auto end = emitJump(OpCode::JUMP, 0);
+
+        patchJump(otherwise);
+        statement(stmt->elseStmt_);
+        patchJump(end);
+    } else {
+        patchJump(otherwise);
+    }
+}
+
+void Compiler::visitBlockStmt(BlockStmtPtr stmt)
+{
+    auto enclosingBase = slotBase_;
+
+    if (stmt->scopeSize_ > 0) {
+        // Its frame starts wherever the stack is at
+        slotBase_ = depth_;
+
+        emit(OpCode::RESERVE, stmt->scopeSize_);
+        emitShort(stmt->scopeSize_);
+    }
+
+    scopes_.push_back(Scope{stmt->closeFrom_, stmt->scopeSize_});
+
+    for (const auto& statement: stmt->statements_) {
+        compile(statement);
+    }
+
+    scopes_.pop_back();
+
+    if (stmt->closeFrom_ >= 0) {
+        emit(OpCode::CLOSE_UPVALUES, 0);
+        emitShort(slot(stmt->closeFrom_));
+    }
+
+    if (stmt->scopeSize_ > 0) {
+        emit(OpCode::POPN, -stmt->scopeSize_);
+        emitShort(stmt->scopeSize_);
+    }
+
+    slotBase_ = enclosingBase;
+}
+
+void Compiler::visitExpressionStmt(ExpressionStmtPtr stmt)
+{
+    compile(stmt->expression_);
+    emit(OpCode::POP_RESULT, -1);
+}
+
+void Compiler::visitPrintStmt(PrintStmtPtr stmt)
+{
+    compile(stmt->expression_);
+    emit(OpCode::PRINT, -1);
+}
+
+void Compiler::visitVarStmt(VarStmtPtr stmt)
+{
+    if (stmt->initializer_) {
+        compile(stmt->initializer_);
+    } else {
+        emit(OpCode::NIL, 1);
+    }
+
+    declare(stmt->slot_, stmt->name_);
+
+    // Like the interpreter, only an initializer is a result
+    emit(stmt->initializer_ ? OpCode::POP_RESULT : OpCode::POP, -1);
+}
+
+void Compiler::visitFunctionStmt(FunctionStmtPtr stmt)
+{
+    if (!stmt->chunk_) {
+        compileFunction(*stmt);
+    }
+
+    emit(OpCode::CLOSURE, 1);
+    emitShort(add(chunk_->functions_, stmt.get(), "functions"));
+
+    // Where each upvalue is captured from, in the frame this code runs in
+    for (const auto& capture: stmt->captures_) {
+        emitByte(capture.local_);
+        emitShort(capture.local_ ? slot(capture.index_) : capture.index_);
+    }
+
+    declare(stmt->slot_, stmt->name_);
+    emit(OpCode::POP, -1);
+}
+
+void Compiler::visitReturnStmt(ReturnStmtPtr stmt)
+{
+    if (stmt->tailCall_) {
+        auto& call = static_cast<CallExpr&>(*stmt->value_);
+
+        compile(call.callee_);
+
+        for (const auto& arg: call.args_) {
+            compile(arg);
+        }
+
+        // The interpreter shows the last argument it evaluated, or the
+        // callee if there are none
+        if (repl_mode_ && shows_ > 0) {
+            emit(OpCode::RESULT, 0);
+            leaveShows(0);
+        }
+
+        emit(OpCode::TAIL_CALL, -static_cast<int>(call.args_.size()) - 1);
+        emitByte(call.args_.size());
+        emitShort(token(call.paren_));
+    } else if (stmt->value_) {
+        compile(stmt->value_);
+
+        if (repl_mode_ && shows_ > 0) {
+            emit(OpCode::RESULT, 0);
+            leaveShows(0);
+        }
+
+        emit(OpCode::RETURN, -1);
+    } else {
+        if (repl_mode_ && shows_ > 0) {
+            emit(OpCode::NIL, 1);
+            emit(OpCode::POP_RESULT, -1);
+            leaveShows(0);
+        }
+
+        emit(OpCode::RETURN_NIL, 0);
+    }
+}
+
+void Compiler::visitBreakStmt(BreakStmtPtr)
+{
+    auto& loop = loops_.back();
+
+    leaveScopes(loop.scopes_);
+    leaveShows(loop.shows_);
+    loop.breaks_.push_back(emitJump(OpCode::JUMP, 0));
+}
+
+void Compiler::visitContinueStmt(ContinueStmtPtr)
+{
+    auto& loop = loops_.back();
+
+    leaveScopes(loop.scopes_);
+    leaveShows(loop.continueShows_);
+    loop.continues_.push_back(emitJump(OpCode::JUMP, 0));
+}
+
+void Compiler::visitClassStmt(ClassStmtPtr stmt)
+{
+    emit(OpCode::CLASS, 1);
+    emitShort(token(stmt->name_));
+
+    declare(stmt->slot_, stmt->name_);
+    emit(OpCode::POP, -1);
+}
+
+void Compiler::compileFunction(FunctionStmt& stmt)
+{
+    auto enclosing = chunk_;
+    auto enclosingDepth = depth_;
+    auto enclosingBase = slotBase_;
+    auto enclosingScopes = std::move(scopes_);
+    auto enclosingLoops = std::move(loops_);
+    auto enclosingShows = shows_;
+
+    stmt.chunk_ = makeRef<Chunk>();
+
+    // The callee's frame starts with its arguments, and the rest of its
+    // slots are cleared when it is called
+    chunk_ = stmt.chunk_.get();
+    depth_ = stmt.scopeSize_;
+    slotBase_ = 0;
+    scopes_.clear();
+    loops_.clear();
+    shows_ = 0;
+
+    chunk_->maxStack_ = depth_;
+
+    for (const auto& statement: stmt.body_) {
+        compile(statement);
+    }
+    emit(OpCode::RETURN_NIL, 0);
+
+    chunk_ = enclosing;
+    depth_ = enclosingDepth;
+    slotBase_ = enclosingBase;
+    scopes_ = std::move(enclosingScopes);
+    loops_ = std::move(enclosingLoops);
+    shows_ = enclosingShows;
+}
+
+void Compiler::declare(int slot, const TokenPtr& name)
+{
+    if (slot < 0) {
+        emit(OpCode::DEFINE_GLOBAL, 0);
+        emitShort(global(name));
+    } else {
+        emit(OpCode::SET_LOCAL, 0);
+        emitShort(this->slot(slot));
+    }
+}
+
+void Compiler::leaveScopes(size_t scopes)
+{
+    // The code after the jump is still in these scopes
+    auto depth = depth_;
+
+    for (auto scope = scopes_.size(); scope-- > scopes;) {
+        if (scopes_[scope].closeFrom_ >= 0) {
+            emit(OpCode::CLOSE_UPVALUES, 0);
+            emitShort(slot(scopes_[scope].closeFrom_));
+        }
+
+        if (scopes_[scope].frameSize_ > 0) {
+            emit(OpCode::POPN, -scopes_[scope].frameSize_);
+            emitShort(scopes_[scope].frameSize_);
+        }
+    }
+
+    depth_ = depth;
+}
+
+void Compiler::emit(OpCode op, int effect)
+{
+    chunk_->code_.push_back(static_cast<uint8_t>(op));
+
+    depth_ += effect;
+    chunk_->maxStack_ = std::max(chunk_->maxStack_, depth_);
+}
+
+void Compiler::emitByte(uint8_t byte)
+{
+    chunk_->code_.push_back(byte);
+}
+
+void Compiler::emitShort(size_t value)
+{
+    chunk_->code_.push_back(value & 0xff);
+    chunk_->code_.push_back((value >> 8) & 0xff);
+}
+
+size_t Compiler::emitJump(OpCode op, int effect)
+{
+    emit(op, effect);
+    emitShort(0);
+
+    return chunk_->code_.size() - 2;
+}
+
+void Compiler::patchJump(size_t operand)
+{
+    // Offsets are from the end of the jump instruction
+    auto offset = chunk_->code_.size() - operand - 2;
+
+    if (offset > MAX_OPERAND) {
+        throw compile_error{"Too much code to jump over."};
+    }
+
+    chunk_->code_[operand] = offset & 0xff;
+    chunk_->code_[operand + 1] = (offset >> 8) & 0xff;
+}
+
+void Compiler::emitLoop(size_t start)
+{
+    emit(OpCode::LOOP, 0);
+
+    auto offset = chunk_->code_.size() + 2 - start;
+
+    if (offset > MAX_OPERAND) {
+        throw compile_error{"Loop body too large."};
+    }
+
+    emitShort(offset);
+}
+
+uint16_t Compiler::slot(int slot)
+{
+    auto index = slotBase_ + slot;
+
+    if (index > MAX_OPERAND) {
+        throw compile_error{"Too many local variables in one function."};
+    }
+
+    return index;
+}
+
+uint16_t Compiler::constant(const Value& value)
+{
+    return add(chunk_->constants_, value, "constants");
+}
+
+uint16_t Compiler::token(const TokenPtr& token)
+{
+    return add(chunk_->tokens_, token, "operators and calls");
+}
+
+uint16_t Compiler::global(const TokenPtr& name)
+{
+    // One entry per reference, for the line of an undefined variable error
+    return add(chunk_->globals_, GlobalRef{name}, "globals");
+}
@@ -2,73 +2,108 @@
 
 #include "lox_exception.hpp"
 
-Environment::Environment(std::shared_ptr<Environment> parent)
-    : parent_{parent}
+Upvalue::Upvalue(Heap& heap, std::vector<Value>& stack, size_t index)
+    : index_{index}
+    , heap_{heap}
+    , stack_{stack}
 { }
 
-void Environment::define(const std::string& name, LoxValuePtr value)
+void Upvalue::set(const Value& value)
 {
-    values_.insert_or_assign(name, value);
+    // The stack is a root, and needs no barrier
+    if (open_) {
+        stack_[index_] = value;
+    } else {
+        heap_.store(this, closed_, value);
+    }
 }
 
-LoxValuePtr Environment::get(TokenPtr token)
+void Upvalue::close()
 {
-    auto it = values_.find(token->lexeme_);
+    auto value = stack_[index_];
 
-    if (it != values_.end()) {
-        return it->second;
-    }
+    heap_.writeBarrier(this, value);
 
-    if (parent_) {
-        return parent_->get(token);
+    if (!heap_.isMarking()) {
+        closed_ = value;
+        open_ = false;
+        return;
     }
 
-    std::string errorMsg_{"Undefined variable '"};
-    errorMsg_.append(token->lexeme_);
-    errorMsg_.append(1, '\'');
+    GcLock lock{this};
 
-    throw interpreter_error{token, std::move(errorMsg_)};
+    closed_ = value;
+    open_ = false;
 }
 
-LoxValuePtr Environment::getAt(int distance, const std::string& name)
+void Upvalue::trace(Heap& heap)
 {
-    return ancestor(distance)->values_.find(name)->second;
+    if (!open_) {
+        heap.mark(closed_);
+    }
 }
 
-void Environment::assign(TokenPtr token, LoxValuePtr value)
+Upvalue* OpenUpvalues::capture(size_t index)
 {
-    auto it = values_.find(token->lexeme_);
+    auto it = upvalues_.end();
 
-    if (it != values_.end()) {
-        it->second = value;
-        return;
-    }
+    while (it != upvalues_.begin() && (*(it - 1))->index_ >= index) {
+        --it;
 
-    if (parent_) {
-        parent_->assign(token, value);
-        return;
+        if ((*it)->index_ == index) {
+            return *it;
+        }
     }
 
-    std::string errorMsg_{"Undefined variable '"};
-    errorMsg_.append(token->lexeme_);
-    errorMsg_.append(1, '\'');
+    return *upvalues_.insert(it, heap_.make<Upvalue>(heap_, stack_, index));
+}
 
-    throw interpreter_error{token, std::move(errorMsg_)};
+void OpenUpvalues::close(size_t index)
+{
+    while (!upvalues_.empty() && upvalues_.back()->index_ >= index) {
+        upvalues_.back()->close();
+        upvalues_.pop_back();
+    }
 }
 
-void Environment::assignAt(int distance, TokenPtr token, LoxValuePtr value)
+void OpenUpvalues::markRoots(Heap& heap)
 {
-    ancestor(distance)->values_.insert_or_assign(token->lexeme_, value);
+    for (auto& upvalue: upvalues_) {
+        heap.mark(upvalue);
+    }
 }
 
-std::shared_ptr<Environment> Environment::ancestor(int distance)
+void GlobalEnvironment::define(LoxString* name, const Value& value)
 {
-    auto env = shared_from_this();
+    auto global = cell(name);
 
-    for (int i = 0; i < distance; ++i) {
-        env = env->parent_;
+    global->value_ = value;
+    global->defined_ = true;
+}
+
+GlobalCell* GlobalEnvironment::cell(LoxString* name)
+{
+    auto [it, inserted] = index_.try_emplace(name, nullptr);
+
+    if (inserted) {
+        it->second = &cells_.emplace_back();
     }
 
-    return env;
+    return it->second;
 }
 
+void GlobalEnvironment::markRoots(Heap& heap)
+{
+    for (auto& cell: cells_) {
+        heap.mark(cell.value_);
+    }
+}
+
+void GlobalEnvironment::undefined(const TokenPtr& token)
+{
+    std::string errorMsg_{"Undefined variable '"};
+    errorMsg_.append(token->lexeme_);
+    errorMsg_.append(1, '\'');
+
+    throw interpreter_error{token, std::move(errorMsg_)};
+}
@@ -1,33 +1,54 @@
 #include "function.hpp"
 
+#include <ostream>
+
 #include "interpreter.hpp"
 #include "lox_exception.hpp"
 
-LoxFunction::LoxFunction(FunctionStmtPtr declaration, std::shared_ptr<Environment> closure)
-    : declaration_{declaration}
-    , closure_{closure}
+LoxFunction::LoxFunction(FunctionStmtPtr declaration, std::vector<Upvalue*> upvalues)
+    : LoxCallable{ObjType::FUNCTION, static_cast<int>(declaration->params_.size())}
+    , declaration_{declaration}
+    , upvalues_{std::move(upvalues)}
 { }
 
-int LoxFunction::arity()
+Value LoxFunction::call(Interpreter& interpreter, size_t frame)
 {
-    return declaration_->params_->size();
-}
+    auto& stack = interpreter.stack_;
+    auto enclosing = interpreter.function_;
 
-LoxValuePtr LoxFunction::call(Interpreter& interpreter, std::vector<LoxValuePtr>& args)
-{
-    auto env = std::make_shared<Environment>(closure_);
+    // The arguments are the first slots of the frame. The function being run
+    // sits right below it, where it stays reachable even once it has been
+    // reached through a tail call.
+    auto function = this;
+
+    for (;;) {
+        auto& declaration = *function->declaration_;
+
+        interpreter.function_ = function;
+        interpreter.executeFrame(declaration.body_, frame, declaration.scopeSize_, declaration.closeFrom_);
+
+        if (interpreter.completion_ != Completion::TAIL_CALL) break;
+
+        // Calls in tail position are made here, reusing the frame that has
+        // just been popped, so that tail recursion runs in constant space
+        auto& tailCall = interpreter.tailCall_;
 
-    for (int i = 0; i < args.size(); ++i) {
-        env->define(declaration_->params_->at(i)->lexeme_, args.at(i));
+        function = tailCall.front().as<LoxFunction>();
+        stack[frame - 1] = tailCall.front();
+        stack.insert(stack.end(), tailCall.begin() + 1, tailCall.end());
+        tailCall.clear();
+
+        interpreter.completion_ = Completion::NORMAL;
     }
 
-    try {
-        interpreter.executeBlock(declaration_->body_, env);
-    } catch (return_value& retVal) {
-        return retVal.value_;
+    interpreter.function_ = enclosing;
+
+    if (interpreter.completion_ == Completion::RETURN) {
+        interpreter.completion_ = Completion::NORMAL;
+        return interpreter.result_;
     }
 
-    return std::make_shared<LoxNil>();
+    return Value::nil();
 }
     
 std::ostream& LoxFunction::operator<<(std::ostream& o)
@@ -36,3 +57,10 @@ std::ostream& LoxFunction::operator<<(std::ostream& o)
     return o;
 }
 
+void LoxFunction::trace(Heap& heap)
+{
+    for (auto& upvalue: upvalues_) {
+        heap.mark(upvalue);
+    }
+}
+
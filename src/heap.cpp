@@ -0,0 +1,421 @@
+#include "heap.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ostream>
+
+#include "value.hpp"
+
+namespace
+{
+    constexpr size_t NURSERY_ALIGNMENT = alignof(std::max_align_t);
+
+    // Number of objects swept between two looks at the clock
+    constexpr size_t SWEEP_CHECK_INTERVAL = 32;
+
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t elapsedNs(Clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+}
+
+thread_local bool Heap::evacuating_ = false;
+
+void PauseStats::record(uint64_t pauseNs)
+{
+    ++pauses_;
+    totalPauseNs_ += pauseNs;
+    maxPauseNs_ = std::max(maxPauseNs_, pauseNs);
+
+    size_t bucket = 0;
+    for (auto us = pauseNs / 1000; us > 0 && bucket < BUCKETS - 1; us >>= 1) {
+        ++bucket;
+    }
+    ++histogram_[bucket];
+}
+
+Heap::Heap(HeapConfig config)
+    : config_{config}
+    , nextGC_{config.initialThreshold_}
+{
+    if (config_.nurserySize_) {
+        auto size = (config_.nurserySize_ + NURSERY_ALIGNMENT - 1) / NURSERY_ALIGNMENT * NURSERY_ALIGNMENT;
+
+        nursery_ = static_cast<char*>(std::aligned_alloc(NURSERY_ALIGNMENT, size));
+        if (!nursery_) {
+            throw std::bad_alloc{};
+        }
+
+        nurseryTop_ = nursery_;
+        nurseryEnd_ = nursery_ + size;
+    }
+
+    if (config_.markThreads_ > 1 || config_.concurrent_) {
+        marker_ = std::make_unique<Marker>(*this, std::max(config_.markThreads_, 1u));
+    }
+}
+
+Heap::~Heap()
+{
+    // Stops the markers of an unfinished concurrent collection while they
+    // can still push to it
+    if (marker_) {
+        marker_->shutdown();
+        marker_.reset();
+    }
+
+    for (auto object: youngObjects_) {
+        object->~GcObject();
+    }
+    std::free(nursery_);
+
+    for (auto list: {objects_, unswept_, permanent_}) {
+        while (list) {
+            auto next = list->next_;
+            delete list;
+            list = next;
+        }
+    }
+}
+
+void* Heap::allocateYoung(size_t size)
+{
+    size = (size + NURSERY_ALIGNMENT - 1) / NURSERY_ALIGNMENT * NURSERY_ALIGNMENT;
+
+    if (static_cast<size_t>(nurseryEnd_ - nurseryTop_) < size) {
+        requestMinor();
+        return nullptr;
+    }
+
+    auto memory = nurseryTop_;
+    nurseryTop_ += size;
+
+    if (config_.stress_) {
+        requestMinor();
+    }
+
+    return memory;
+}
+
+void Heap::requestMinor()
+{
+    minorRequested_ = true;
+    collectionPending_ = true;
+}
+
+void Heap::track(GcObject* object, GcObject*& list)
+{
+    object->next_ = list;
+    list = object;
+
+    // Allocated black, the markers may not see it anymore
+    object->marked_ = marking_;
+
+    bytesAllocated_ += object->footprint();
+
+    if (config_.stress_ || bytesAllocated_ > nextGC_) {
+        collectionPending_ = true;
+    }
+}
+
+void Heap::remember(GcObject* object)
+{
+    if (!object->remembered_) {
+        object->remembered_ = true;
+        remembered_.push_back(object);
+    }
+}
+
+void Heap::addRoots(GcRoots* roots)
+{
+    roots_.push_back(roots);
+}
+
+void Heap::removeRoots(GcRoots* roots)
+{
+    roots_.erase(std::remove(roots_.begin(), roots_.end(), roots), roots_.end());
+}
+
+void Heap::markObject(GcObject* object)
+{
+    // Young objects are never marked: a stop-the-world major collection runs
+    // with an empty nursery, and a concurrent one keeps them all alive
+    if (!object || object->young_) return;
+
+    if (std::atomic_ref<bool>{object->marked_}.exchange(true, std::memory_order_relaxed)) return;
+
+    if (marker_) {
+        marker_->push(object);
+    } else {
+        grayStack_.push_back(object);
+    }
+}
+
+void Heap::shadeObject(const Value& value)
+{
+    if (value.isObject()) {
+        markObject(value.asObject());
+    }
+}
+
+void Heap::mark(Value& slot)
+{
+    if (!slot.isObject()) return;
+
+    auto object = slot.asObject();
+    mark(object);
+
+    if (evacuating_) {
+        slot = Value{object};
+    }
+}
+
+void Heap::traceObject(GcObject* object)
+{
+    if (marking_) {
+        GcLock lock{object};
+        object->trace(*this);
+    } else {
+        object->trace(*this);
+    }
+}
+
+GcObject* Heap::evacuate(GcObject* object)
+{
+    if (object->next_) {
+        return object->next_;
+    }
+
+    auto copy = object->relocate(allocator_);
+    copy->young_ = false;
+    track(copy, objects_);
+
+    object->next_ = copy;
+
+    ++stats_.objectsPromoted_;
+    stats_.bytesPromoted_ += copy->footprint();
+
+    // Scanned later for references to other young objects
+    grayStack_.push_back(copy);
+
+    return copy;
+}
+
+void Heap::collect()
+{
+    auto majorDue = config_.stress_ || bytesAllocated_ > nextGC_;
+
+    switch (phase_) {
+        case Phase::IDLE:
+        {
+            // A major collection always starts with a minor one, so that it
+            // runs with an empty nursery and remembered set
+            if (minorRequested_ || majorDue) {
+                minorCollection();
+            }
+
+            if (majorDue) {
+                if (config_.concurrent_) {
+                    startMarking();
+                } else {
+                    majorCollection();
+                }
+            }
+            break;
+        }
+        case Phase::MARKING:
+        {
+            if (minorRequested_) {
+                minorCollection();
+            }
+
+            // Once the workers are done, or were stopped with work left
+            if (!marker_->running() || marker_->idle()) {
+                finishMarking();
+            }
+            break;
+        }
+        case Phase::SWEEPING:
+        {
+            if (minorRequested_) {
+                minorCollection();
+            }
+
+            auto start = Clock::now();
+            sweep(/* bounded = */ true);
+            stats_.major_.record(elapsedNs(start));
+            break;
+        }
+    }
+
+    minorRequested_ = false;
+    collectionPending_ = phase_ != Phase::IDLE;
+}
+
+void Heap::minorCollection()
+{
+    auto start = Clock::now();
+
+    evacuating_ = true;
+
+    for (auto roots: roots_) {
+        roots->markRoots(*this);
+    }
+
+    for (auto object: remembered_) {
+        object->remembered_ = false;
+        traceObject(object);
+    }
+    remembered_.clear();
+
+    traceReferences();
+
+    evacuating_ = false;
+
+    // Everything left in the nursery is either dead or a moved-from shell
+    for (auto object: youngObjects_) {
+        object->~GcObject();
+    }
+    youngObjects_.clear();
+    nurseryTop_ = nursery_;
+
+    stats_.minor_.record(elapsedNs(start));
+}
+
+void Heap::markRoots()
+{
+    for (auto roots: roots_) {
+        roots->markRoots(*this);
+    }
+}
+
+void Heap::majorCollection()
+{
+    auto start = Clock::now();
+
+    markRoots();
+
+    if (marker_) {
+        marker_->markParallel();
+    } else {
+        traceReferences();
+    }
+
+    unswept_ = objects_;
+    objects_ = nullptr;
+    sweep(/* bounded = */ false);
+
+    ++stats_.majorCollections_;
+    stats_.major_.record(elapsedNs(start));
+}
+
+void Heap::startMarking()
+{
+    auto start = Clock::now();
+
+    marker_->beginRoots();
+    markRoots();
+
+    phase_ = Phase::MARKING;
+    marking_ = true;
+
+    ++stats_.majorCollections_;
+    stats_.major_.record(elapsedNs(start));
+
+    // Not part of the pause: with fewer cores than threads, the woken
+    // workers may take the core from the mutator for a while
+    marker_->startConcurrent();
+}
+
+void Heap::finishMarking()
+{
+    auto start = Clock::now();
+
+    // The remark goes on at the next safepoint if it runs out of budget
+    if (marker_->finishConcurrent(config_.pauseBudgetUs_ * 1000)) {
+        marking_ = false;
+
+        unswept_ = objects_;
+        objects_ = nullptr;
+        phase_ = Phase::SWEEPING;
+    }
+
+    stats_.major_.record(elapsedNs(start));
+}
+
+void Heap::traceReferences()
+{
+    while (!grayStack_.empty()) {
+        auto object = grayStack_.back();
+        grayStack_.pop_back();
+
+        traceObject(object);
+    }
+}
+
+void Heap::sweep(bool bounded)
+{
+    auto start = Clock::now();
+    auto budgetNs = config_.pauseBudgetUs_ * 1000;
+
+    for (size_t swept = 1; unswept_; ++swept) {
+        auto object = unswept_;
+        unswept_ = object->next_;
+
+        if (object->marked_) {
+            object->marked_ = false;
+            object->next_ = objects_;
+            objects_ = object;
+        } else {
+            auto size = object->footprint();
+            bytesAllocated_ -= std::min(size, bytesAllocated_);
+
+            ++stats_.objectsFreed_;
+            stats_.bytesFreed_ += size;
+
+            delete object;
+        }
+
+        if (bounded && swept % SWEEP_CHECK_INTERVAL == 0 && elapsedNs(start) > budgetNs) {
+            return;
+        }
+    }
+
+    nextGC_ = std::max(static_cast<size_t>(bytesAllocated_ * config_.growthFactor_), config_.initialThreshold_);
+    phase_ = Phase::IDLE;
+}
+
+void Heap::printStats(std::ostream& o) const
+{
+    auto printPauses = [&o](const char* name, const PauseStats& pauses) {
+        o << "GC " << name << ": " << pauses.pauses_ << " pause(s), "
+          << "total " << pauses.totalPauseNs_ / 1000 << " us, "
+          << "max " << pauses.maxPauseNs_ / 1000 << " us" << std::endl;
+
+        for (size_t i = 0; i < PauseStats::BUCKETS; ++i) {
+            if (!pauses.histogram_[i]) continue;
+
+            if (i == PauseStats::BUCKETS - 1) {
+                o << "  >= " << (uint64_t{1} << (i - 1)) << " us: ";
+            } else {
+                o << "  < " << (uint64_t{1} << i) << " us: ";
+            }
+            o << pauses.histogram_[i] << std::endl;
+        }
+    };
+
+    printPauses("minor", stats_.minor_);
+    printPauses("major", stats_.major_);
+
+    o << "GC: " << stats_.majorCollections_ << " major collection(s), "
+      << stats_.objectsPromoted_ << " object(s) / " << stats_.bytesPromoted_ << " byte(s) promoted, "
+      << stats_.objectsFreed_ << " object(s) / " << stats_.bytesFreed_ << " byte(s) freed" << std::endl;
+
+    o << "Heap: " << bytesAllocated_ << " byte(s) in old space, next collection at " << nextGC_
+      << ", nursery " << (nurseryEnd_ - nursery_) << " byte(s)" << std::endl;
+
+    allocator_.printStats(o);
+}
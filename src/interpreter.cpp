@@ -2,190 +2,332 @@
 
 #include "lox_exception.hpp"
 #include "native_clock.hpp"
+#include "native_string.hpp"
 #include "function.hpp"
 #include "lox_class.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <cmath>
 
-#define CAST(TO_TYPE, FROM_VAL) std::dynamic_pointer_cast<TO_TYPE>(FROM_VAL)
 #define EPS 1e-6
 
-Interpreter::Interpreter(bool repl_mode)
-    : repl_mode_{repl_mode}
-    , result_{std::make_shared<LoxNil>()}
-    , global_{std::make_shared<Environment>()}
-    , env_{global_}
+namespace
 {
-    global_->define("clock", std::make_shared<NativeClock>());
+    BinaryForm specialize(TokenType op, const Value& left, const Value& right)
+    {
+        if (left.isSmallInt() && right.isSmallInt()) {
+            switch (op) {
+                case TokenType::PLUS: return BinaryForm::INT_ADD;
+                case TokenType::MINUS: return BinaryForm::INT_SUBTRACT;
+                case TokenType::STAR: return BinaryForm::INT_MULTIPLY;
+                case TokenType::LESS: return BinaryForm::INT_LESS;
+                case TokenType::LESS_EQUAL: return BinaryForm::INT_LESS_EQUAL;
+                case TokenType::GREATER: return BinaryForm::INT_GREATER;
+                case TokenType::GREATER_EQUAL: return BinaryForm::INT_GREATER_EQUAL;
+                case TokenType::EQUAL_EQUAL: return BinaryForm::INT_EQUAL;
+                case TokenType::BANG_EQUAL: return BinaryForm::INT_NOT_EQUAL;
+                default: return BinaryForm::GENERIC;
+            }
+        }
+
+        if (left.isFloat() && right.isFloat()) {
+            switch (op) {
+                case TokenType::PLUS: return BinaryForm::FLOAT_ADD;
+                case TokenType::MINUS: return BinaryForm::FLOAT_SUBTRACT;
+                case TokenType::STAR: return BinaryForm::FLOAT_MULTIPLY;
+                case TokenType::LESS: return BinaryForm::FLOAT_LESS;
+                case TokenType::LESS_EQUAL: return BinaryForm::FLOAT_LESS_EQUAL;
+                case TokenType::GREATER: return BinaryForm::FLOAT_GREATER;
+                case TokenType::GREATER_EQUAL: return BinaryForm::FLOAT_GREATER_EQUAL;
+                default: return BinaryForm::GENERIC;
+            }
+        }
+
+        if (left.isString() && right.isString() && op == TokenType::PLUS) {
+            return BinaryForm::STRING_ADD;
+        }
+
+        // Division keeps its checks for 0, and mixed operands are converted
+        return BinaryForm::GENERIC;
+    }
+
+    // Makes the frame starting at `base` the innermost one, and pops it
+    // however its statements are left, a runtime error included
+    struct FrameGuard
+    {
+        FrameGuard(Interpreter& interpreter, size_t base, int closeFrom)
+            : interpreter_{interpreter}, base_{base}, enclosing_{interpreter.frame_}, closeFrom_{closeFrom}
+        {
+            interpreter_.frame_ = base_;
+        }
+
+        ~FrameGuard()
+        {
+            if (closeFrom_ >= 0) {
+                interpreter_.openUpvalues_.close(base_ + closeFrom_);
+            }
+
+            interpreter_.frame_ = enclosing_;
+            interpreter_.stack_.resize(base_);
+        }
+
+    private:
+        Interpreter& interpreter_;
+        size_t base_;
+        size_t enclosing_;
+        int closeFrom_;
+    };
 }
 
-void Interpreter::visitAssignExpr(AssignExprPtr expr)
+Interpreter::Interpreter(bool repl_mode, HeapConfig heapConfig)
+    : heap_{heapConfig}
+    , strings_{heap_}
+    , repl_mode_{repl_mode}
+    , result_{Value::nil()}
 {
-    auto right = evaluate(expr->value_);
+    heap_.addRoots(this);
 
-    auto it = locals_.find(expr);
+    global_.define(strings_.intern("clock"), Value{heap_.make<NativeClock>()});
+    global_.define(strings_.intern("length"), Value{heap_.make<NativeLength>()});
+    global_.define(strings_.intern("substring"), Value{heap_.make<NativeSubstring>()});
+    global_.define(strings_.intern("indexOf"), Value{heap_.make<NativeIndexOf>()});
+    global_.define(strings_.intern("trim"), Value{heap_.make<NativeTrim>()});
+    global_.define(strings_.intern("split"), Value{heap_.make<NativeSplit>()});
+}
 
-    if (it != locals_.end()) {
-        env_->assignAt(it->second, expr->name_, result_);
-    } else {
-        global_->assign(expr->name_, result_);
-    }
+void Interpreter::visitAssignExpr(AssignExprPtr expr)
+{
+    assign(*expr, evaluate(expr->value_));
 }
 
 void Interpreter::visitBinaryExpr(BinaryExprPtr expr)
 {
-    auto left = evaluate(expr->left_);
+    // Evaluating the right operand may reach a safepoint, which can move the
+    // left one; it is kept on the stack and reloaded afterwards
+    stack_.push_back(evaluate(expr->left_));
     auto right = evaluate(expr->right_);
+    auto left = stack_.back();
+    stack_.pop_back();
+
+    applyBinary(*expr, left, right);
+}
+
+void Interpreter::applyBinary(BinaryExpr& expr, const Value& left, const Value& right)
+{
+#define INT_FORM(form, value)                                       \
+        case BinaryForm::form:                                      \
+            if (left.isSmallInt() && right.isSmallInt()) {          \
+                auto a = left.asSmallInt(), b = right.asSmallInt(); \
+                result_ = value;                                    \
+                return;                                             \
+            }                                                       \
+            break;
+
+#define FLOAT_FORM(form, value)                                     \
+        case BinaryForm::form:                                      \
+            if (left.isFloat() && right.isFloat()) {                \
+                auto a = left.asDouble(), b = right.asDouble();     \
+                result_ = value;                                    \
+                return;                                             \
+            }                                                       \
+            break;
+
+    switch (expr.form_) {
+        INT_FORM(INT_ADD, Value::integer(a + b, heap_))
+        INT_FORM(INT_SUBTRACT, Value::integer(a - b, heap_))
+        INT_FORM(INT_MULTIPLY, Value::integer(a * b, heap_))
+        INT_FORM(INT_LESS, Value::boolean(a < b))
+        INT_FORM(INT_LESS_EQUAL, Value::boolean(a <= b))
+        INT_FORM(INT_GREATER, Value::boolean(a > b))
+        INT_FORM(INT_GREATER_EQUAL, Value::boolean(a >= b))
+        INT_FORM(INT_EQUAL, Value::boolean(a == b))
+        INT_FORM(INT_NOT_EQUAL, Value::boolean(a != b))
+
+        FLOAT_FORM(FLOAT_ADD, Value::number(a + b))
+        FLOAT_FORM(FLOAT_SUBTRACT, Value::number(a - b))
+        FLOAT_FORM(FLOAT_MULTIPLY, Value::number(a * b))
+        FLOAT_FORM(FLOAT_LESS, Value::boolean(a < b))
+        FLOAT_FORM(FLOAT_LESS_EQUAL, Value::boolean(a <= b))
+        FLOAT_FORM(FLOAT_GREATER, Value::boolean(a > b))
+        FLOAT_FORM(FLOAT_GREATER_EQUAL, Value::boolean(a >= b))
+
+        case BinaryForm::STRING_ADD:
+            if (left.isString() && right.isString()) {
+                result_ = concatenate(left.as<LoxString>(), right.as<LoxString>());
+                return;
+            }
+            break;
+
+        case BinaryForm::UNSPECIALIZED:
+            // This run takes the generic path, the next ones the form
+            expr.form_ = specialize(expr.op_->tokenType_, left, right);
+            applyBinary(expr.op_, left, right);
+            return;
 
-    switch (expr->op_->tokenType_)
+        case BinaryForm::GENERIC:
+            applyBinary(expr.op_, left, right);
+            return;
+    }
+
+#undef FLOAT_FORM
+#undef INT_FORM
+
+    // The guard failed: the operands have changed types
+    expr.form_ = BinaryForm::GENERIC;
+    applyBinary(expr.op_, left, right);
+}
+
+void Interpreter::applyBinary(const TokenPtr& op, const Value& left, const Value& right)
+{
+    switch (op->tokenType_)
     {
         case TokenType::MINUS:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
-                result_ = std::make_shared<LoxFloat>(val1 - val2);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
+                result_ = Value::number(val1 - val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
-                result_ = std::make_shared<LoxInteger>(val1 - val2);
+                auto val1 = left.asInt(), val2 = right.asInt();
+                result_ = Value::integer(val1 - val2, heap_);
             }
 
             break;
         }
         case TokenType::SLASH:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
 
                 if (std::abs(val2) < EPS) {
-                    throw interpreter_error{expr->op_, "Division by 0"};
+                    throw interpreter_error{op, "Division by 0"};
                 }
 
-                result_ = std::make_shared<LoxFloat>(val1 / val2);
+                result_ = Value::number(val1 / val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
+                auto val1 = left.asInt(), val2 = right.asInt();
 
                 if (val2 == 0) {
-                    throw interpreter_error{expr->op_, "Division by 0"};
+                    throw interpreter_error{op, "Division by 0"};
                 }
 
-                result_ = std::make_shared<LoxInteger>(val1 / val2);
+                result_ = Value::integer(val1 / val2, heap_);
             }
 
             break;
         }
         case TokenType::STAR:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
-                result_ = std::make_shared<LoxFloat>(val1 * val2);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
+                result_ = Value::number(val1 * val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
-                result_ = std::make_shared<LoxInteger>(val1 * val2);
+                auto val1 = left.asInt(), val2 = right.asInt();
+                result_ = Value::integer(val1 * val2, heap_);
             }
 
             break;
         }
         case TokenType::PLUS:
         {
-            if (isNum(left) && isNum(right)) {
-                if (isFloat(left) || isFloat(right)) {
-                    auto val1 = getFloat(left), val2 = getFloat(right);
-                    result_ = std::make_shared<LoxFloat>(val1 + val2);
+            if (left.isNum() && right.isNum()) {
+                if (left.isFloat() || right.isFloat()) {
+                    auto val1 = left.asFloat(), val2 = right.asFloat();
+                    result_ = Value::number(val1 + val2);
                 } else {
-                    auto val1 = getInt(left), val2 = getInt(right);
-                    result_ = std::make_shared<LoxInteger>(val1 + val2);
+                    auto val1 = left.asInt(), val2 = right.asInt();
+                    result_ = Value::integer(val1 + val2, heap_);
                 }
-            } else if (isString(left) && isString(right)) {
-                result_ = std::make_shared<LoxString>(CAST(LoxString, left)->value_ + CAST(LoxString, right)->value_);
+            } else if (left.isString() && right.isString()) {
+                result_ = concatenate(left.as<LoxString>(), right.as<LoxString>());
             } else {
-                throw interpreter_error{expr->op_, "Operands must be both strings or numbers."};
+                throw interpreter_error{op, "Operands must be both strings or numbers."};
             }
 
             break;
         }
         case TokenType::GREATER:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
             bool comp;
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
                 comp = (val1 > val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
+                auto val1 = left.asInt(), val2 = right.asInt();
                 comp = (val1 > val2);
             }
 
-            result_ = std::make_shared<LoxBool>(comp);
+            result_ = Value::boolean(comp);
             break;
         }
         case TokenType::GREATER_EQUAL:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
             bool comp;
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
                 comp = (val1 >= val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
+                auto val1 = left.asInt(), val2 = right.asInt();
                 comp = (val1 >= val2);
             }
 
-            result_ = std::make_shared<LoxBool>(comp);
+            result_ = Value::boolean(comp);
             break;
         }
         case TokenType::LESS:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
             bool comp;
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
                 comp = (val1 < val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
+                auto val1 = left.asInt(), val2 = right.asInt();
                 comp = (val1 < val2);
             }
 
-            result_ = std::make_shared<LoxBool>(comp);
+            result_ = Value::boolean(comp);
             break;
         }
         case TokenType::LESS_EQUAL:
         {
-            checkNumberOps(expr->op_, left, right);
+            checkNumberOps(op, left, right);
 
             bool comp;
 
-            if (isFloat(left) || isFloat(right)) {
-                auto val1 = getFloat(left), val2 = getFloat(right);
+            if (left.isFloat() || right.isFloat()) {
+                auto val1 = left.asFloat(), val2 = right.asFloat();
                 comp = (val1 <= val2);
             } else {
-                auto val1 = getInt(left), val2 = getInt(right);
+                auto val1 = left.asInt(), val2 = right.asInt();
                 comp = (val1 <= val2);
             }
 
-            result_ = std::make_shared<LoxBool>(comp);
+            result_ = Value::boolean(comp);
             break;
         }
         case TokenType::BANG_EQUAL:
         {
-            result_ = std::make_shared<LoxBool>(!isEqual(left, right));
+            result_ = Value::boolean(!isEqual(left, right));
             break;
         }
         case TokenType::EQUAL_EQUAL:
         {
-            result_ = std::make_shared<LoxBool>(isEqual(left, right));
+            result_ = Value::boolean(isEqual(left, right));
             break;
         }
         default:
@@ -207,22 +349,25 @@ void Interpreter::visitLiteralExpr(LiteralExprPtr expr)
 
 void Interpreter::visitUnaryExpr(UnaryExprPtr expr)
 {
-    auto right = evaluate(expr->right_);
+    applyUnary(expr->op_, evaluate(expr->right_));
+}
 
-    switch (expr->op_->tokenType_) {
+void Interpreter::applyUnary(const TokenPtr& op, const Value& right)
+{
+    switch (op->tokenType_) {
         case TokenType::BANG:
         {
-            result_ = std::make_shared<LoxBool>(!isTruthy(right));
+            result_ = Value::boolean(!isTruthy(right));
             break;
         }
         case TokenType::MINUS:
         {
-            checkNumberOp(expr->op_, right);
+            checkNumberOp(op, right);
 
-            if (isFloat(right)) {
-                result_ = std::make_shared<LoxFloat>(-getFloat(right));
+            if (right.isFloat()) {
+                result_ = Value::number(-right.asFloat());
             } else {
-                result_ = std::make_shared<LoxInteger>(-getInt(right));
+                result_ = Value::integer(-right.asInt(), heap_);
             }
 
             break;
@@ -236,7 +381,13 @@ void Interpreter::visitUnaryExpr(UnaryExprPtr expr)
 
 void Interpreter::visitVariableExpr(VariableExprPtr expr)
 {
-    result_ = lookupVariable(expr->name_, expr);
+    if (expr->slot_ >= 0) {
+        result_ = stack_[frame_ + expr->slot_];
+    } else if (expr->upvalue_ >= 0) {
+        result_ = function_->upvalue(expr->upvalue_)->get();
+    } else {
+        result_ = global_.get(expr->name_, expr->global_);
+    }
 }
 
 void Interpreter::visitLogicalExpr(LogicalExprPtr expr)
@@ -258,34 +409,113 @@ void Interpreter::visitLogicalExpr(LogicalExprPtr expr)
 
 void Interpreter::visitCallExpr(CallExprPtr expr)
 {
-    auto callee = evaluate(expr->callee_);
+    auto base = prepareCall(*expr);
+    auto callee = checkCall(*expr, base);
+    result_ = finishCall(*expr, base, callee);
+}
+
+size_t Interpreter::prepareCall(CallExpr& expr)
+{
+    // The callee and the arguments are kept on the stack for the duration of
+    // the call, so that neither is collected while the others are evaluated
+    // or while the call runs.
+    auto base = stack_.size();
+    stack_.push_back(evaluate(expr.callee_));
 
-    std::vector<LoxValuePtr> args;
-    for (auto arg: *(expr->args_)) {
-        args.push_back(evaluate(arg));
+    for (const auto& arg: expr.args_) {
+        stack_.push_back(evaluate(arg));
     }
 
-    if (auto function = CAST(LoxCallable, callee)) {
-        if (args.size() != function->arity()) {
-            std::string errorMsg_{"Expected "};
-            errorMsg_.append(std::to_string(function->arity()));
-            errorMsg_.append(" argument(s) but got ");
-            errorMsg_.append(std::to_string(args.size()));
-            errorMsg_.append(1, '.');
+    return base;
+}
+
+CallCache::Entry Interpreter::checkCall(CallExpr& expr, size_t base)
+{
+    return checkCallee(expr.cache_, expr.paren_, stack_[base], expr.args_.size());
+}
 
-            throw interpreter_error{expr->paren_, errorMsg_};
+CallCache::Entry Interpreter::checkCallee(CallCache& cache, const TokenPtr& paren, const Value& callee, size_t argc)
+{
+    if (callee.isObject()) {
+        if (auto entry = cache.find(callee.asObject(), heap_.stats().objectsFreed_)) {
+            return *entry;
         }
+    }
+
+    checkCallee(paren, callee, argc);
+    return cache.insert(callee.as<LoxCallable>());
+}
+
+void Interpreter::checkCallee(const TokenPtr& paren, const Value& callee, size_t argc)
+{
+    if (!callee.isCallable()) {
+        throw interpreter_error{paren, "Can only call functions and classes."};
+    }
+
+    auto function = callee.as<LoxCallable>();
+    if (argc != static_cast<size_t>(function->arity())) {
+        std::string errorMsg_{"Expected "};
+        errorMsg_.append(std::to_string(function->arity()));
+        errorMsg_.append(" argument(s) but got ");
+        errorMsg_.append(std::to_string(argc));
+        errorMsg_.append(1, '.');
 
-        result_ = function->call(*this, args);
+        throw interpreter_error{paren, errorMsg_};
+    }
+}
+
+Value Interpreter::finishCall(CallExpr& expr, size_t base, const CallCache::Entry& callee)
+{
+    Value result;
+
+    // Either way the arguments are used where they were evaluated
+    if (callee.function_) {
+        result = callee.function_->call(*this, base + 1);
     } else {
-        throw interpreter_error{expr->paren_, "Can only call functions and classes."};
+        try {
+            result = callee.native_->call(*this, std::span<Value>{stack_}.subspan(base + 1));
+        } catch (native_error& error) {
+            throw interpreter_error{expr.paren_, error.what()};
+        }
     }
+
+    stack_.resize(base);
+    return result;
 }
 
 void Interpreter::visitWhileStmt(WhileStmtPtr stmt)
 {
+    // The body of a for loop is shown together with its increment, as a
+    // single statement
+    auto& increment = stmt->increment_;
+
     while (isTruthy(evaluate(stmt->condition_))) {
-        execute(stmt->statements_);
+        if (increment) {
+            stmt->statements_->accept(*this);
+        } else {
+            execute(stmt->statements_);
+        }
+
+        if (completion_ != Completion::NORMAL) {
+            if (completion_ == Completion::BREAK) {
+                completion_ = Completion::NORMAL;
+                if (increment) show();
+                break;
+            }
+
+            if (completion_ != Completion::CONTINUE) {
+                if (increment) show();
+                return;
+            }
+            completion_ = Completion::NORMAL;
+        }
+
+        if (increment) {
+            evaluate(increment);
+            show();
+        }
+
+        heap_.safepoint();
     }
 }
 
@@ -300,7 +530,17 @@ void Interpreter::visitIfStmt(IfStmtPtr stmt)
 
 void Interpreter::visitBlockStmt(BlockStmtPtr stmt)
 {
-    executeBlock(stmt->statements_, std::make_shared<Environment>(env_));
+    if (stmt->scopeSize_ == 0) {
+        // Its variables, if any, live in the current frame
+        executeBlock(stmt->statements_);
+
+        if (stmt->closeFrom_ >= 0) {
+            openUpvalues_.close(frame_ + stmt->closeFrom_);
+        }
+        return;
+    }
+
+    executeFrame(stmt->statements_, stack_.size(), stmt->scopeSize_, stmt->closeFrom_);
 }
 
 void Interpreter::visitExpressionStmt(ExpressionStmtPtr stmt)
@@ -312,206 +552,259 @@ void Interpreter::visitPrintStmt(PrintStmtPtr stmt)
 {
     auto value = evaluate(stmt->expression_);
 
-    std::cout << *value << std::endl;
+    std::cout << value << std::endl;
 }
 
 void Interpreter::visitVarStmt(VarStmtPtr stmt)
 {
-    LoxValuePtr initVal;
+    Value initVal;
     if (stmt->initializer_) {
         initVal = evaluate(stmt->initializer_);
     } else {
-        initVal = std::make_shared<LoxNil>();
+        initVal = Value::nil();
     }
 
-    env_->define(stmt->name_->lexeme_, initVal);
+    declare(stmt->slot_, stmt->name_, initVal);
 }
 
 void Interpreter::visitFunctionStmt(FunctionStmtPtr stmt)
 {
-    auto funcDef = std::make_shared<LoxFunction>(stmt, env_);
-    env_->define(stmt->name_->lexeme_, funcDef);
+    std::vector<Upvalue*> upvalues;
+
+    for (const auto& capture: stmt->captures_) {
+        upvalues.push_back(capture.local_ ? openUpvalues_.capture(frame_ + capture.index_) : function_->upvalue(capture.index_));
+    }
+
+    declare(stmt->slot_, stmt->name_, Value{heap_.make<LoxFunction>(stmt, std::move(upvalues))});
 }
 
 void Interpreter::visitReturnStmt(ReturnStmtPtr stmt)
 {
-    LoxValuePtr retValue;
-    
-    if (stmt->value_) {
-        retValue = evaluate(stmt->value_);
+    if (stmt->tailCall_) {
+        auto& call = static_cast<CallExpr&>(*stmt->value_);
+        auto base = prepareCall(call);
+        auto callee = checkCall(call, base);
+
+        if (callee.function_) {
+            tailCall_.assign(stack_.begin() + base, stack_.end());
+            stack_.resize(base);
+
+            completion_ = Completion::TAIL_CALL;
+            return;
+        }
+
+        result_ = finishCall(call, base, callee);
+    } else if (stmt->value_) {
+        evaluate(stmt->value_);
     } else {
-        retValue = std::make_shared<LoxNil>();
+        result_ = Value::nil();
     }
-        
-    throw return_value{retValue};
+
+    completion_ = Completion::RETURN;
 }
 
-void Interpreter::visitClassStmt(ClassStmtPtr stmt)
+void Interpreter::visitBreakStmt(BreakStmtPtr)
 {
-    env_->define(stmt->name_->lexeme_, nullptr);
+    completion_ = Completion::BREAK;
+}
 
-    auto loxClass = std::make_shared<LoxClass>(stmt->name_->lexeme_);
+void Interpreter::visitContinueStmt(ContinueStmtPtr)
+{
+    completion_ = Completion::CONTINUE;
+}
 
-    env_->assign(stmt->name_, loxClass);
+void Interpreter::visitClassStmt(ClassStmtPtr stmt)
+{
+    declare(stmt->slot_, stmt->name_, Value{heap_.make<LoxClass>(stmt->name_->lexeme_)});
 }
 
-bool Interpreter::isTruthy(LoxValuePtr value)
+bool Interpreter::isTruthy(const Value& value)
 {
-    if (auto boolVal = std::dynamic_pointer_cast<LoxBool>(value)) {
-        return boolVal->value_;
+    if (value.isBool()) {
+        return value.asBool();
     }
 
-    if (auto numberVal = std::dynamic_pointer_cast<LoxInteger>(value)) {
-        return numberVal->value_ != 0;
+    if (value.isInt()) {
+        return value.asInt() != 0;
     }
 
-    if (auto nilVal = std::dynamic_pointer_cast<LoxNil>(value)) {
+    if (value.isNil()) {
         return false;
     }
 
     return true;
 }
 
-bool Interpreter::isEqual(LoxValuePtr a, LoxValuePtr b)
+bool Interpreter::isEqual(const Value& a, const Value& b)
 {
-    if (auto nila = CAST(LoxNil, a)) {
-        if (auto nilb = CAST(LoxNil, b)) {
-            return true;
-        }
-        return false;
-    } else if (auto nilb = CAST(LoxNil, b)) {
+    if (a.isNil()) {
+        return b.isNil();
+    } else if (b.isNil()) {
         return false;
     }
 
-    if (isNum(a) && isNum(b)) {
-        auto val1 = getFloat(a), val2 = getFloat(b);
+    if (a.isNum() && b.isNum()) {
+        auto val1 = a.asFloat(), val2 = b.asFloat();
         return std::abs(val1 - val2) < EPS;
     }
 
-    if (isString(a) && isString(b)) {
-        return CAST(LoxString, a)->value_ == CAST(LoxString, b)->value_;
-    }
+    if (a.isString() && b.isString()) {
+        auto str1 = a.as<LoxString>(), str2 = b.as<LoxString>();
 
-    if (isBool(a) && isBool(b)) {
-        return CAST(LoxBool, a)->value_ == CAST(LoxBool, b)->value_;
-    }
+        if (str1 == str2) {
+            return true;
+        }
 
-    return false;
-}
+        // Interned strings are unique, so distinct ones always differ
+        if (str1->interned_ && str2->interned_) {
+            return false;
+        }
 
-bool Interpreter::isBool(LoxValuePtr value)
-{
-    if (auto boolVal = CAST(LoxBool, value)) {
-        return true;
-    }
+        if (str1->length() != str2->length()) {
+            return false;
+        }
 
-    return false;
-}
+        return str1->chars() == str2->chars();
+    }
 
-bool Interpreter::isNum(LoxValuePtr value)
-{
-    if (auto numVal = CAST(LoxInteger, value)) {
-        return true;
-    } else if (auto floatVal = CAST(LoxFloat, value)) {
-        return true;
+    if (a.isBool() && b.isBool()) {
+        return a.asBool() == b.asBool();
     }
 
     return false;
 }
 
-bool Interpreter::isFloat(LoxValuePtr value)
+Value Interpreter::concatenate(LoxString* left, LoxString* right)
 {
-    if (auto floatVal = CAST(LoxFloat, value)) {
-        return true;
+    if (left->length() == 0) {
+        return Value{right};
     }
 
-    return false;
-}
-
-bool Interpreter::isString(LoxValuePtr value)
-{
-    if (auto strVal = CAST(LoxString, value)) {
-        return true;
+    if (right->length() == 0) {
+        return Value{left};
     }
-    return false;
-}
 
-int64_t Interpreter::getInt(LoxValuePtr value)
-{
-    return CAST(LoxInteger, value)->value_;
-}
+    if (left->length() + right->length() < LoxString::MIN_ROPE_LENGTH) {
+        std::string chars{left->chars()};
+        chars.append(right->chars());
 
-double Interpreter::getFloat(LoxValuePtr value)
-{
-    if (auto floatVal = CAST(LoxFloat, value)) {
-        return floatVal->value_;
+        return Value{heap_.make<LoxString>(std::move(chars))};
     }
-    return CAST(LoxInteger, value)->value_;
+
+    return Value{heap_.make<LoxString>(left, right)};
 }
 
-void Interpreter::checkNumberOp(TokenPtr op, LoxValuePtr value)
+void Interpreter::checkNumberOp(const TokenPtr& op, const Value& value)
 {
-    if (isNum(value)) return;
+    if (value.isNum()) return;
     throw interpreter_error{op, "Operand must be a number."};
 }
 
-void Interpreter::checkNumberOps(TokenPtr op, LoxValuePtr left, LoxValuePtr right)
+void Interpreter::checkNumberOps(const TokenPtr& op, const Value& left, const Value& right)
 {
-    if (isNum(left) && isNum(right)) return;
+    if (left.isNum() && right.isNum()) return;
     throw interpreter_error{op, "Operands must be numbers."};
 }
 
-LoxValuePtr Interpreter::evaluate(ExprPtr expr)
+Value Interpreter::evaluate(const ExprPtr& expr)
 {
     expr->accept(*this);
     return result_;
 }
 
-void Interpreter::execute(StmtPtr stmt)
+void Interpreter::execute(const StmtPtr& stmt)
 {
     stmt->accept(*this);
+    show();
+}
 
+void Interpreter::show()
+{
     if (repl_mode_) {
-        std::cout << *result_ << std::endl;
+        std::cout << result_ << std::endl;
     }
 }
 
-void Interpreter::executeBlock(std::shared_ptr<std::vector<StmtPtr>> statements, std::shared_ptr<Environment> env)
+void Interpreter::executeBlock(const std::vector<StmtPtr>& statements)
 {
-    auto previousEnv = env_;
-    env_ = env;
-
-    EnvGuard envGuard{env_, previousEnv};
-
-    for (auto stmt: *statements) {
+    for (const auto& stmt: statements) {
+        heap_.safepoint();
         stmt->accept(*this);
+
+        if (completion_ != Completion::NORMAL) return;
     }
 }
 
-LoxValuePtr Interpreter::lookupVariable(TokenPtr name, ExprPtr expr)
+void Interpreter::executeFrame(const std::vector<StmtPtr>& statements, size_t base, int size, int closeFrom)
 {
-    auto it = locals_.find(expr);
+    stack_.resize(base + size, Value::nil());
 
-    if (it != locals_.end()) {
-        return env_->getAt(it->second, name->lexeme_);
+    FrameGuard guard{*this, base, closeFrom};
+    executeBlock(statements);
+}
+
+void Interpreter::assign(AssignExpr& expr, const Value& value)
+{
+    if (expr.slot_ >= 0) {
+        stack_[frame_ + expr.slot_] = value;
+    } else if (expr.upvalue_ >= 0) {
+        function_->upvalue(expr.upvalue_)->set(value);
     } else {
-        return global_->get(name);
+        global_.assign(expr.name_, expr.global_, value);
     }
 }
 
-void Interpreter::resolve(ExprPtr expr, int depth)
+void Interpreter::declare(int slot, const TokenPtr& name, const Value& value)
 {
-    locals_.insert_or_assign(expr, depth);
+    if (slot < 0) {
+        global_.define(name->symbol_, value);
+    } else {
+        stack_[frame_ + slot] = value;
+    }
 }
 
 void Interpreter::interpret(const std::vector<StmtPtr>& statements)
 {
     try {
-        for (auto statement: statements) {
+        for (const auto& statement: statements) {
+            heap_.safepoint();
             execute(statement);
         }
     } catch (interpreter_error& error) {
-        std::cerr << "Line [" << error.token_->line_ << "]: " << error.what() << std::endl;
+        abort(error);
+    }
+}
+
+void Interpreter::abort(const interpreter_error& error)
+{
+    std::cerr << "Line [" << error.token_->line_ << "]: " << error.what() << std::endl;
+
+    // The frames are gone, but closures may still be reachable
+    openUpvalues_.close(0);
+
+    // Whatever was in flight when the error was raised is garbage now
+    stack_.clear();
+    frame_ = 0;
+    function_ = nullptr;
+    completion_ = Completion::NORMAL;
+    tailCall_.clear();
+}
+
+void Interpreter::markRoots(Heap& heap)
+{
+    heap.mark(result_);
+    heap.mark(function_);
+
+    openUpvalues_.markRoots(heap);
+
+    global_.markRoots(heap);
+
+    for (auto& value: tailCall_) {
+        heap.mark(value);
+    }
+
+    for (auto& value: stack_) {
+        heap.mark(value);
     }
 }
 
@@ -1,7 +1,10 @@
 #include "lox_class.hpp"
 
+#include <ostream>
+
 LoxClass::LoxClass(std::string name)
-    : name_{name}
+    : LoxObject{ObjType::CLASS}
+    , name_{name}
 { }
 
 std::ostream& LoxClass::operator<<(std::ostream& o)
@@ -1,19 +1,105 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include "runner.hpp"
 
+namespace
+{
+    // Matches `--name=value`, returning the value
+    const char* optionValue(const char* arg, const char* name)
+    {
+        auto length = std::strlen(name);
+
+        if (std::strncmp(arg, name, length) == 0 && arg[length] == '=') {
+            return arg + length + 1;
+        }
+        return nullptr;
+    }
+
+    void usage(const char* prog)
+    {
+        std::cout << "Usage: " << prog
+                  << " [--stats] [--engine=tree|stack|bytecode|register|closure] [--max-depth=<calls>] [--max-nesting=<levels>]"
+                  << " [--disassemble]"
+                  << " [--gc-threshold=<bytes>] [--gc-growth=<factor>] [--gc-nursery=<bytes>]"
+                  << " [--gc-threads=<n>] [--gc-concurrent] [--gc-pause-budget=<us>] [--gc-stress] [script]"
+                  << std::endl;
+    }
+}
+
 int main(int argc, char **argv)
 {
-    if (argc > 2) {
-        std::cout << "Usage: " << argv[0] << " [script]" << std::endl;
-        return 1;
-    } else if (argc == 2) {
-        Runner runner;
-        runner.runFromFile(argv[1]);
+    const char* script = nullptr;
+    bool printStats = false;
+    HeapConfig heapConfig;
+    RunnerConfig runnerConfig;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* value;
+
+        if (std::strcmp(argv[i], "--stats") == 0) {
+            printStats = true;
+        } else if (std::strcmp(argv[i], "--disassemble") == 0) {
+            runnerConfig.disassemble_ = true;
+        } else if (std::strcmp(argv[i], "--gc-stress") == 0) {
+            heapConfig.stress_ = true;
+        } else if (std::strcmp(argv[i], "--gc-concurrent") == 0) {
+            heapConfig.concurrent_ = true;
+        } else if ((value = optionValue(argv[i], "--engine"))) {
+            if (std::strcmp(value, "tree") == 0) {
+                runnerConfig.engine_ = Engine::TREE;
+            } else if (std::strcmp(value, "stack") == 0) {
+                runnerConfig.engine_ = Engine::STACK;
+            } else if (std::strcmp(value, "bytecode") == 0) {
+                runnerConfig.engine_ = Engine::BYTECODE;
+            } else if (std::strcmp(value, "register") == 0) {
+                runnerConfig.engine_ = Engine::REGISTER;
+            } else if (std::strcmp(value, "closure") == 0) {
+                runnerConfig.engine_ = Engine::CLOSURE;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if ((value = optionValue(argv[i], "--max-depth"))) {
+            runnerConfig.maxDepth_ = std::max(1ull, std::strtoull(value, nullptr, 10));
+        } else if ((value = optionValue(argv[i], "--max-nesting"))) {
+            runnerConfig.maxNesting_ = std::max(1ull, std::strtoull(value, nullptr, 10));
+        } else if ((value = optionValue(argv[i], "--gc-threads"))) {
+            heapConfig.markThreads_ = std::max(1ul, std::strtoul(value, nullptr, 10));
+        } else if ((value = optionValue(argv[i], "--gc-pause-budget"))) {
+            heapConfig.pauseBudgetUs_ = std::strtoull(value, nullptr, 10);
+        } else if ((value = optionValue(argv[i], "--gc-threshold"))) {
+            heapConfig.initialThreshold_ = std::strtoull(value, nullptr, 10);
+        } else if ((value = optionValue(argv[i], "--gc-nursery"))) {
+            heapConfig.nurserySize_ = std::strtoull(value, nullptr, 10);
+        } else if ((value = optionValue(argv[i], "--gc-growth"))) {
+            heapConfig.growthFactor_ = std::strtod(value, nullptr);
+
+            if (heapConfig.growthFactor_ < 1.0) {
+                std::cout << "--gc-growth must be at least 1" << std::endl;
+                return 1;
+            }
+        } else if (argv[i][0] == '-' || script) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            script = argv[i];
+        }
+    }
+
+    Runner runner{/* repl_mode = */ script == nullptr, heapConfig, runnerConfig};
+
+    if (script) {
+        runner.runFromFile(script);
     } else {
-        Runner runner{/* repl_mode = */ true};
         runner.runFromPrompt();
     }
 
+    if (printStats) {
+        runner.printStats(std::cerr);
+    }
+
     return 0;
 }
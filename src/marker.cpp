@@ -0,0 +1,271 @@
+#include "marker.hpp"
+
+#include <chrono>
+
+#include "heap.hpp"
+
+thread_local Marker::WorkStack* Marker::current_ = nullptr;
+
+Marker::Marker(Heap& heap, unsigned workers)
+    : heap_{heap}
+{
+    for (unsigned i = 0; i < workers; ++i) {
+        stacks_.push_back(std::make_unique<WorkStack>());
+    }
+
+    threads_.resize(workers);
+}
+
+Marker::~Marker()
+{
+    shutdown();
+}
+
+void Marker::shutdown()
+{
+    if (running()) {
+        stop_ = true;
+        waitParked();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard{parkLock_};
+        shutdown_ = true;
+    }
+    wake_.notify_all();
+
+    for (auto& thread: threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    background_ = false;
+}
+
+void Marker::push(GcObject* object)
+{
+    if (current_) {
+        current_->private_.push_back(object);
+
+        if (current_->private_.size() >= PUBLISH_THRESHOLD && current_->sharedSize_ == 0) {
+            publish(*current_);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard{injected_.lock_};
+    injected_.shared_.push_back(object);
+    ++injected_.sharedSize_;
+}
+
+void Marker::publish(WorkStack& stack)
+{
+    auto half = stack.private_.size() / 2;
+
+    std::lock_guard<std::mutex> guard{stack.lock_};
+    stack.shared_.insert(stack.shared_.end(), stack.private_.begin(), stack.private_.begin() + half);
+    stack.sharedSize_ += half;
+    stack.private_.erase(stack.private_.begin(), stack.private_.begin() + half);
+}
+
+bool Marker::steal(WorkStack& from, WorkStack& to)
+{
+    if (from.sharedSize_ == 0) return false;
+
+    std::lock_guard<std::mutex> guard{from.lock_};
+
+    auto count = (from.shared_.size() + 1) / 2;
+    if (count == 0) return false;
+
+    to.private_.insert(to.private_.end(), from.shared_.begin(), from.shared_.begin() + count);
+    from.shared_.erase(from.shared_.begin(), from.shared_.begin() + count);
+    from.sharedSize_ -= count;
+
+    return true;
+}
+
+GcObject* Marker::next(WorkStack& stack)
+{
+    if (stack.private_.empty()) {
+        auto found = steal(stack, stack) || steal(injected_, stack);
+
+        for (size_t i = 0; !found && i < stacks_.size(); ++i) {
+            found = stacks_[i].get() != &stack && steal(*stacks_[i], stack);
+        }
+
+        if (!found) return nullptr;
+    }
+
+    auto object = stack.private_.back();
+    stack.private_.pop_back();
+    return object;
+}
+
+bool Marker::hasVisibleWork() const
+{
+    if (injected_.sharedSize_) return true;
+
+    for (auto& stack: stacks_) {
+        if (stack->sharedSize_) return true;
+    }
+    return false;
+}
+
+void Marker::wake(unsigned first)
+{
+    for (auto i = first; i < threads_.size(); ++i) {
+        if (!threads_[i].joinable()) {
+            threads_[i] = std::thread{&Marker::park, this, i};
+        }
+    }
+
+    active_ = stacks_.size() - first;
+
+    {
+        std::lock_guard<std::mutex> guard{parkLock_};
+        first_ = first;
+        ++generation_;
+    }
+    wake_.notify_all();
+}
+
+void Marker::park(unsigned index)
+{
+    uint64_t seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard{parkLock_};
+            wake_.wait(guard, [&] { return shutdown_ || (generation_ != seen && index >= first_); });
+
+            if (shutdown_) return;
+            seen = generation_;
+        }
+
+        work(index);
+        --active_;
+    }
+}
+
+void Marker::waitParked()
+{
+    while (active_ > 0) {
+        std::this_thread::yield();
+    }
+}
+
+void Marker::work(unsigned index)
+{
+    auto& stack = *stacks_[index];
+    current_ = &stack;
+
+    for (;;) {
+        while (auto object = next(stack)) {
+            heap_.traceObject(object);
+        }
+
+        // Out of work. Marking is over once every worker is, unless it runs
+        // concurrently and the mutator may still inject more.
+        --busy_;
+
+        for (;;) {
+            if (stop_) {
+                current_ = nullptr;
+                return;
+            }
+
+            if (hasVisibleWork()) {
+                ++busy_;
+                break;
+            }
+
+            if (!concurrent_ && busy_ == 0) {
+                current_ = nullptr;
+                return;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Marker::markParallel()
+{
+    concurrent_ = false;
+    stop_ = false;
+    busy_ = stacks_.size();
+
+    // The calling thread is the first worker
+    wake(1);
+    work(0);
+    waitParked();
+}
+
+void Marker::beginRoots()
+{
+    current_ = stacks_[0].get();
+}
+
+void Marker::startConcurrent()
+{
+    current_ = nullptr;
+
+    concurrent_ = true;
+    stop_ = false;
+    busy_ = stacks_.size();
+    background_ = true;
+
+    wake(0);
+}
+
+bool Marker::idle() const
+{
+    return busy_ == 0 && !hasVisibleWork();
+}
+
+bool Marker::finishConcurrent(uint64_t budgetNs)
+{
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+
+    if (background_) {
+        stop_ = true;
+        waitParked();
+        background_ = false;
+
+        // Workers may have stopped with work left, and the mutator may have
+        // injected more since they went idle
+        auto& stack = *stacks_[0];
+
+        for (auto& other: stacks_) {
+            if (other.get() != &stack) {
+                stack.private_.insert(stack.private_.end(), other->private_.begin(), other->private_.end());
+                other->private_.clear();
+            }
+        }
+    }
+
+    // Whatever is left over is traced in slices, the mutator's barrier
+    // injecting more in between
+    auto& stack = *stacks_[0];
+    current_ = &stack;
+
+    auto done = true;
+    size_t traced = 0;
+
+    while (auto object = next(stack)) {
+        heap_.traceObject(object);
+
+        if (++traced % DRAIN_CHECK_INTERVAL == 0 && Clock::now() - start > std::chrono::nanoseconds{budgetNs}) {
+            done = false;
+            break;
+        }
+    }
+
+    current_ = nullptr;
+
+    if (done) {
+        concurrent_ = false;
+    }
+    return done;
+}
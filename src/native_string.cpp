@@ -0,0 +1,185 @@
+#include "native_string.hpp"
+
+#include <ostream>
+
+#include "interpreter.hpp"
+#include "lox_exception.hpp"
+
+namespace
+{
+    LoxString* expectString(std::span<Value> args, size_t index)
+    {
+        if (!args[index].isString()) {
+            throw native_error{"Argument " + std::to_string(index + 1) + " must be a string."};
+        }
+        return args[index].as<LoxString>();
+    }
+
+    int64_t expectInt(std::span<Value> args, size_t index)
+    {
+        if (!args[index].isInt()) {
+            throw native_error{"Argument " + std::to_string(index + 1) + " must be an integer."};
+        }
+        return args[index].asInt();
+    }
+
+    // Returns [offset, offset + length) of string, sharing its characters
+    // when the result is long enough to be worth it.
+    Value slice(Interpreter& interpreter, LoxString* string, size_t offset, size_t length)
+    {
+        if (offset == 0 && length == string->length()) {
+            return Value{string};
+        }
+
+        if (length < LoxString::MIN_SLICE_LENGTH) {
+            auto chars = string->chars().substr(offset, length);
+            return Value{interpreter.heap_.make<LoxString>(std::string{chars})};
+        }
+
+        return Value{interpreter.heap_.make<LoxString>(string, offset, length)};
+    }
+
+    bool isSpace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+}
+
+NativeLength::NativeLength()
+    : LoxNative{1}
+{ }
+
+Value NativeLength::call(Interpreter& interpreter, std::span<Value> args)
+{
+    auto string = expectString(args, 0);
+
+    return Value::integer(string->length(), interpreter.heap_);
+}
+
+std::ostream& NativeLength::operator<<(std::ostream& o)
+{
+    o << "<native-fn>";
+    return o;
+}
+
+NativeSubstring::NativeSubstring()
+    : LoxNative{3}
+{ }
+
+Value NativeSubstring::call(Interpreter& interpreter, std::span<Value> args)
+{
+    auto string = expectString(args, 0);
+    auto start = expectInt(args, 1);
+    auto end = expectInt(args, 2);
+
+    if (start < 0 || end < start || end > static_cast<int64_t>(string->length())) {
+        throw native_error{"Substring range out of bounds."};
+    }
+
+    return slice(interpreter, string, start, end - start);
+}
+
+std::ostream& NativeSubstring::operator<<(std::ostream& o)
+{
+    o << "<native-fn>";
+    return o;
+}
+
+NativeIndexOf::NativeIndexOf()
+    : LoxNative{2}
+{ }
+
+Value NativeIndexOf::call(Interpreter& interpreter, std::span<Value> args)
+{
+    auto string = expectString(args, 0);
+    auto needle = expectString(args, 1);
+
+    auto index = string->chars().find(needle->chars());
+
+    if (index == std::string_view::npos) {
+        return Value::integer(-1, interpreter.heap_);
+    }
+
+    return Value::integer(index, interpreter.heap_);
+}
+
+std::ostream& NativeIndexOf::operator<<(std::ostream& o)
+{
+    o << "<native-fn>";
+    return o;
+}
+
+NativeTrim::NativeTrim()
+    : LoxNative{1}
+{ }
+
+Value NativeTrim::call(Interpreter& interpreter, std::span<Value> args)
+{
+    auto string = expectString(args, 0);
+    auto chars = string->chars();
+
+    size_t start = 0, end = chars.size();
+
+    while (start < end && isSpace(chars[start])) {
+        ++start;
+    }
+
+    while (end > start && isSpace(chars[end - 1])) {
+        --end;
+    }
+
+    return slice(interpreter, string, start, end - start);
+}
+
+std::ostream& NativeTrim::operator<<(std::ostream& o)
+{
+    o << "<native-fn>";
+    return o;
+}
+
+NativeSplit::NativeSplit()
+    : LoxNative{3}
+{ }
+
+Value NativeSplit::call(Interpreter& interpreter, std::span<Value> args)
+{
+    auto string = expectString(args, 0);
+    auto separator = expectString(args, 1);
+    auto index = expectInt(args, 2);
+
+    if (separator->length() == 0) {
+        throw native_error{"Separator must not be empty."};
+    }
+
+    if (index < 0) {
+        return Value::nil();
+    }
+
+    auto chars = string->chars();
+    auto sep = separator->chars();
+
+    size_t start = 0;
+
+    for (int64_t field = 0; field < index; ++field) {
+        auto next = chars.find(sep, start);
+
+        if (next == std::string_view::npos) {
+            return Value::nil();
+        }
+
+        start = next + sep.size();
+    }
+
+    auto end = chars.find(sep, start);
+    if (end == std::string_view::npos) {
+        end = chars.size();
+    }
+
+    return slice(interpreter, string, start, end - start);
+}
+
+std::ostream& NativeSplit::operator<<(std::ostream& o)
+{
+    o << "<native-fn>";
+    return o;
+}
@@ -2,8 +2,16 @@
 
 #include <iostream>
 
-Parser::Parser(const std::vector<TokenPtr>& tokens)
+#include "stack_limit.hpp"
+
+size_t Parser::defaultMaxNesting()
+{
+    return stackBudget() / STACK_BYTES_PER_NESTING;
+}
+
+Parser::Parser(const std::vector<TokenPtr>& tokens, size_t maxNesting)
     : tokens_{tokens}
+    , maxNesting_{maxNesting}
 {}
 
 auto Parser::error(TokenPtr token, const std::string& msg) -> parsing_error
@@ -17,6 +25,16 @@ auto Parser::error(TokenPtr token, const std::string& msg) -> parsing_error
     return parsing_error{""};
 }
 
+Parser::Nesting::Nesting(Parser& parser)
+    : parser_{parser}
+{
+    if (parser_.nesting_ == parser_.maxNesting_) {
+        parser_.too_deep_ = true;
+        throw parser_.error(parser_.peek(), "Too deeply nested.");
+    }
+    ++parser_.nesting_;
+}
+
 TokenPtr Parser::peek()
 {
     return tokens_[current_];
@@ -55,6 +73,7 @@ TokenPtr Parser::consume(TokenType tokenType, const std::string& msg)
 
 ExprPtr Parser::parseExpression()
 {
+    Nesting nesting{*this};
     return parseAssignment();
 }
 
@@ -64,10 +83,12 @@ ExprPtr Parser::parseAssignment()
 
     if (match(TokenType::EQUAL)) {
         auto equals = previous();
+
+        Nesting nesting{*this};
         auto value = parseAssignment();
 
-        if (auto var = std::dynamic_pointer_cast<VariableExpr>(expr)) {
-            return std::make_shared<AssignExpr>(var->name_, value);
+        if (auto var = dynamic_cast<VariableExpr*>(expr.get())) {
+            return makeRef<AssignExpr>(var->name_, value);
         }
 
         error(equals, "Invalid assignment target.");
@@ -84,7 +105,7 @@ ExprPtr Parser::parseOr()
         auto op = previous();
         auto right = parseAnd();
 
-        expr = std::make_shared<LogicalExpr>(expr, op, right);
+        expr = makeRef<LogicalExpr>(expr, op, right);
     }
 
     return expr;
@@ -98,7 +119,7 @@ ExprPtr Parser::parseAnd()
         auto op = previous();
         auto right = parseEquality();
 
-        expr = std::make_shared<LogicalExpr>(expr, op, right);
+        expr = makeRef<LogicalExpr>(expr, op, right);
     }
 
     return expr;
@@ -112,7 +133,7 @@ ExprPtr Parser::parseEquality()
         auto op = previous();
         auto right = parseComparison();
 
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = makeRef<BinaryExpr>(expr, op, right);
     }
 
     return expr;
@@ -126,7 +147,7 @@ ExprPtr Parser::parseComparison()
         auto op = previous();
         auto right = parseTerm();
 
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = makeRef<BinaryExpr>(expr, op, right);
     }
 
     return expr;
@@ -140,7 +161,7 @@ ExprPtr Parser::parseTerm()
         auto op = previous();
         auto right = parseFactor();
 
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = makeRef<BinaryExpr>(expr, op, right);
     }
 
     return expr;
@@ -154,7 +175,7 @@ ExprPtr Parser::parseFactor()
         auto op = previous();
         auto right = parseUnary();
 
-        expr = std::make_shared<BinaryExpr>(expr, op, right);
+        expr = makeRef<BinaryExpr>(expr, op, right);
     }
 
     return expr;
@@ -164,9 +185,11 @@ ExprPtr Parser::parseUnary()
 {
     if (match(TokenType::BANG, TokenType::MINUS)) {
         auto op = previous();
+
+        Nesting nesting{*this};
         auto right = parseUnary();
 
-        return std::make_shared<UnaryExpr>(op, right);
+        return makeRef<UnaryExpr>(op, right);
     }
 
     return parseCall();
@@ -189,34 +212,34 @@ ExprPtr Parser::parseCall()
 
 ExprPtr Parser::finishCall(ExprPtr expr)
 {
-    auto args = std::make_shared<std::vector<ExprPtr>>();
+    std::vector<ExprPtr> args;
 
     if (!check(TokenType::RIGHT_PAREN)) {
         do {
-            if (args->size() >= 255) {
+            if (args.size() >= 255) {
                 error(peek(), "Can't have more than 255 argumnets");
             }
-            args->push_back(parseExpression());
+            args.push_back(parseExpression());
         } while (match(TokenType::COMMA));
     }
 
     auto paren = consume(TokenType::RIGHT_PAREN, "Expected ')' after arguments");
 
-    return std::make_shared<CallExpr>(expr, paren, args);
+    return makeRef<CallExpr>(expr, paren, std::move(args));
 }
 
 ExprPtr Parser::parsePrimary()
 {
     if (match(TokenType::TRUE, TokenType::FALSE)) {
-        return std::make_shared<LiteralExpr>(std::make_shared<LoxBool>(previous()->tokenType_ == TokenType::TRUE));
+        return makeRef<LiteralExpr>(Value::boolean(previous()->tokenType_ == TokenType::TRUE));
     }
 
     if (match(TokenType::NIL)) {
-        return std::make_shared<LiteralExpr>(std::make_shared<LoxNil>());
+        return makeRef<LiteralExpr>(Value::nil());
     }
 
     if (match(TokenType::NUMBER, TokenType::STRING)) {
-        return std::make_shared<LiteralExpr>(previous()->value_);
+        return makeRef<LiteralExpr>(previous()->value_);
     }
 
     if (match(TokenType::LEFT_PAREN)) {
@@ -224,11 +247,11 @@ ExprPtr Parser::parsePrimary()
 
         consume(TokenType::RIGHT_PAREN, "Expected ')' after expression");
 
-        return std::make_shared<GroupingExpr>(exp);
+        return makeRef<GroupingExpr>(exp);
     }
 
     if (match(TokenType::IDENTIFIER)) {
-        return std::make_shared<VariableExpr>(previous());
+        return makeRef<VariableExpr>(previous());
     }
 
     throw error(peek(), "Expected expression");
@@ -263,25 +286,16 @@ StmtPtr Parser::parseForStmt()
 
     StmtPtr body = parseStatement();
 
-    if (increment) {
-        body = std::make_shared<BlockStmt>(
-                std::make_shared<std::vector<StmtPtr>>(
-                    std::initializer_list<StmtPtr>{body, std::make_shared<ExpressionStmt>(increment)}
-                )
-            );
-    }
-
     if (!cond) {
-        cond = std::make_shared<LiteralExpr>(std::make_shared<LoxBool>(true));
+        cond = makeRef<LiteralExpr>(Value::boolean(true));
     }
 
-    body = std::make_shared<WhileStmt>(cond, body);
+    // The increment is kept apart from the body, so that `continue` runs it
+    body = makeRef<WhileStmt>(cond, body, increment);
 
     if (init) {
-        body = std::make_shared<BlockStmt>(
-                std::make_shared<std::vector<StmtPtr>>(
-                    std::initializer_list<StmtPtr>{init, body}
-                )
+        body = makeRef<BlockStmt>(
+                std::vector<StmtPtr>{init, body}
             );
     }
     
@@ -298,7 +312,7 @@ StmtPtr Parser::parseWhileStmt()
 
     auto whileBlock = parseStatement();
 
-    return std::make_shared<WhileStmt>(cond, whileBlock);
+    return makeRef<WhileStmt>(cond, whileBlock, nullptr);
 }
 
 StmtPtr Parser::parseIfStmt()
@@ -316,15 +330,15 @@ StmtPtr Parser::parseIfStmt()
         elseBlock = parseStatement();
     }
 
-    return std::make_shared<IfStmt>(cond, thenBlock, elseBlock);
+    return makeRef<IfStmt>(cond, thenBlock, elseBlock);
 }
 
 decltype(BlockStmt::statements_) Parser::parseBlock()
 {
-    auto statements = std::make_shared<std::vector<StmtPtr>>();
+    std::vector<StmtPtr> statements;
 
     while (!check(TokenType::RIGHT_BRACE) && !atEnd()) {
-        statements->push_back(parseDeclaration());
+        statements.push_back(parseDeclaration());
     }
 
     consume(TokenType::RIGHT_BRACE, "Expected '}' after block");
@@ -338,7 +352,7 @@ StmtPtr Parser::parsePrintStmt()
 
     consume(TokenType::SEMICOLON, "Expected ';' after value");
 
-    return std::make_shared<PrintStmt>(exp);
+    return makeRef<PrintStmt>(exp);
 }
 
 StmtPtr Parser::parseReturnStmt()
@@ -352,7 +366,25 @@ StmtPtr Parser::parseReturnStmt()
 
     consume(TokenType::SEMICOLON, "Expected ';' after return statement.");
 
-    return std::make_shared<ReturnStmt>(returnToken, value);
+    return makeRef<ReturnStmt>(returnToken, value);
+}
+
+StmtPtr Parser::parseBreakStmt()
+{
+    auto keyword = previous();
+
+    consume(TokenType::SEMICOLON, "Expected ';' after break.");
+
+    return makeRef<BreakStmt>(keyword);
+}
+
+StmtPtr Parser::parseContinueStmt()
+{
+    auto keyword = previous();
+
+    consume(TokenType::SEMICOLON, "Expected ';' after continue.");
+
+    return makeRef<ContinueStmt>(keyword);
 }
 
 StmtPtr Parser::parseExpressionStmt()
@@ -361,16 +393,18 @@ StmtPtr Parser::parseExpressionStmt()
 
     consume(TokenType::SEMICOLON, "Expected ';' after expression");
 
-    return std::make_shared<ExpressionStmt>(exp);
+    return makeRef<ExpressionStmt>(exp);
 }
 
 StmtPtr Parser::parseStatement()
 {
+    Nesting nesting{*this};
+
     if (match(TokenType::PRINT)) {
         return parsePrintStmt();
     }
     if (match(TokenType::LEFT_BRACE)) {
-        return std::make_shared<BlockStmt>(parseBlock());
+        return makeRef<BlockStmt>(parseBlock());
     }
     if (match(TokenType::IF)) {
         return parseIfStmt();
@@ -384,6 +418,12 @@ StmtPtr Parser::parseStatement()
     if (match(TokenType::RETURN)) {
         return parseReturnStmt();
     }
+    if (match(TokenType::BREAK)) {
+        return parseBreakStmt();
+    }
+    if (match(TokenType::CONTINUE)) {
+        return parseContinueStmt();
+    }
 
     return parseExpressionStmt();
 }
@@ -400,22 +440,24 @@ StmtPtr Parser::parseVarDeclaration()
 
     consume(TokenType::SEMICOLON, "Expected ';' after variable declaration");
 
-    return std::make_shared<VarStmt>(ident, init);
+    return makeRef<VarStmt>(ident, init);
 }
 
 FunctionStmtPtr Parser::parseFunction(const std::string& kind)
 {
+    Nesting nesting{*this};
+
     auto name = consume(TokenType::IDENTIFIER, std::string{"Expected "} + kind + std::string{" name."});
 
     consume(TokenType::LEFT_PAREN, std::string{"Expected '(' after "} + kind + std::string{" name."});
 
-    auto params = std::make_shared<std::vector<TokenPtr>>();
+    std::vector<TokenPtr> params;
     if (!check(TokenType::RIGHT_PAREN)) {
         do {
-            if (params->size() >= 255) {
+            if (params.size() >= 255) {
                 error(peek(), "Can't have more than 255 parameters.");
             }
-            params->push_back(consume(TokenType::IDENTIFIER, "Expected parameter name."));
+            params.push_back(consume(TokenType::IDENTIFIER, "Expected parameter name."));
         } while (match(TokenType::COMMA));
     }
 
@@ -424,7 +466,7 @@ FunctionStmtPtr Parser::parseFunction(const std::string& kind)
 
     auto body = parseBlock();
 
-    return std::make_shared<FunctionStmt>(name, params, body);
+    return makeRef<FunctionStmt>(name, std::move(params), std::move(body));
 }
 
 StmtPtr Parser::parseClass()
@@ -433,14 +475,14 @@ StmtPtr Parser::parseClass()
 
     consume(TokenType::LEFT_BRACE, "Expected '{' before class body.");
 
-    auto methods = std::make_shared<std::vector<FunctionStmtPtr>>();
+    std::vector<FunctionStmtPtr> methods;
     while (!check(TokenType::RIGHT_BRACE) && !atEnd()) {
-        methods->push_back(parseFunction("method"));
+        methods.push_back(parseFunction("method"));
     }
 
     consume(TokenType::RIGHT_BRACE, "Expected '}' after class body.");
 
-    return std::make_shared<ClassStmt>(name, methods);
+    return makeRef<ClassStmt>(name, std::move(methods));
 }
 
 StmtPtr Parser::parseDeclaration()
@@ -460,6 +502,14 @@ StmtPtr Parser::parseDeclaration()
     } catch (parsing_error& error) {
         parsing_failed_ = true;
 
+        if (too_deep_) {
+            if (nesting_ > 0) throw;
+
+            // Nothing more is parsed
+            current_ = tokens_.size() - 1;
+            return nullptr;
+        }
+
         synchronize();
 
         return nullptr;
@@ -482,6 +532,8 @@ void Parser::synchronize()
             case TokenType::WHILE:
             case TokenType::PRINT:
             case TokenType::RETURN:
+            case TokenType::BREAK:
+            case TokenType::CONTINUE:
                 return;
             default:
                 break;
@@ -0,0 +1,145 @@
+#include "register_chunk.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+#include "stmt.hpp"
+
+namespace
+{
+    const char* const OP_NAMES[] = {
+#define LOX_REGISTER_OP_NAME(name) #name,
+        LOX_REGISTER_OPS(LOX_REGISTER_OP_NAME)
+#undef LOX_REGISTER_OP_NAME
+    };
+
+    struct Printer
+    {
+        std::ostream& o_;
+        const RegisterChunk& chunk_;
+
+        void reg(uint16_t operand)
+        {
+            o_ << 'r' << operand;
+        }
+
+        void rk(uint16_t operand)
+        {
+            if (operand & RegisterChunk::CONSTANT) {
+                operand &= ~RegisterChunk::CONSTANT;
+                o_ << 'k' << operand << '=' << chunk_.constants_[operand];
+            } else {
+                reg(operand);
+            }
+        }
+
+        void global(uint16_t operand)
+        {
+            o_ << 'g' << operand << '=' << chunk_.globals_[operand].name_->lexeme_;
+        }
+
+        void target(uint16_t operand)
+        {
+            o_ << "-> " << std::setw(4) << std::setfill('0') << operand << std::setfill(' ');
+        }
+    };
+}
+
+void disassemble(std::ostream& o, const RegisterChunk& chunk, const std::string& name)
+{
+    o << "== " << name << " (" << chunk.registers_ << " registers) ==" << std::endl;
+
+    Printer p{o, chunk};
+
+    for (size_t i = 0; i < chunk.code_.size(); ++i) {
+        auto& instruction = chunk.code_[i];
+        auto& token = chunk.tokens_[i];
+
+        o << std::setw(4) << std::setfill('0') << i << std::setfill(' ') << ' ';
+
+        if (token) {
+            o << std::setw(4) << token->line_;
+        } else {
+            o << "   |";
+        }
+
+        o << "  " << std::left << std::setw(16) << OP_NAMES[static_cast<size_t>(instruction.op_)] << std::right;
+
+        auto a = instruction.a_, b = instruction.b_, c = instruction.c_;
+
+        switch (instruction.op_) {
+            case RegisterOp::MOVE:
+                p.reg(a); o << ", "; p.reg(b);
+                break;
+            case RegisterOp::LOAD_CONSTANT:
+                p.reg(a); o << ", "; p.rk(b);
+                break;
+            case RegisterOp::LOAD_NIL:
+            case RegisterOp::CLOSE_UPVALUES:
+                p.reg(a);
+                break;
+            case RegisterOp::GET_UPVALUE:
+                p.reg(a); o << ", u" << b;
+                break;
+            case RegisterOp::SET_UPVALUE:
+                o << 'u' << a << ", "; p.rk(b);
+                break;
+            case RegisterOp::GET_GLOBAL:
+                p.reg(a); o << ", "; p.global(b);
+                break;
+            case RegisterOp::SET_GLOBAL:
+            case RegisterOp::DEFINE_GLOBAL:
+                p.global(a); o << ", "; p.rk(b);
+                break;
+            case RegisterOp::EQUAL:
+            case RegisterOp::NOT_EQUAL:
+            case RegisterOp::GREATER:
+            case RegisterOp::GREATER_EQUAL:
+            case RegisterOp::LESS:
+            case RegisterOp::LESS_EQUAL:
+            case RegisterOp::ADD:
+            case RegisterOp::SUBTRACT:
+            case RegisterOp::MULTIPLY:
+            case RegisterOp::DIVIDE:
+                p.reg(a); o << ", "; p.rk(b); o << ", "; p.rk(c);
+                break;
+            case RegisterOp::NOT:
+            case RegisterOp::NEGATE:
+                p.reg(a); o << ", "; p.rk(b);
+                break;
+            case RegisterOp::RESULT:
+            case RegisterOp::PRINT:
+            case RegisterOp::RETURN:
+                p.rk(a);
+                break;
+            case RegisterOp::SHOW:
+            case RegisterOp::RETURN_NIL:
+                break;
+            case RegisterOp::JUMP:
+            case RegisterOp::LOOP:
+                p.target(a);
+                break;
+            case RegisterOp::JUMP_IF_FALSE:
+            case RegisterOp::JUMP_IF_TRUE:
+                p.rk(a); o << ' '; p.target(b);
+                break;
+            case RegisterOp::CALL:
+            case RegisterOp::TAIL_CALL:
+                p.reg(a); o << ", " << b << " argument(s)";
+                break;
+            case RegisterOp::CLOSURE:
+                p.reg(a); o << ", f" << b << '=' << chunk.functions_[b]->name_->lexeme_ << ", base r" << c;
+                break;
+            case RegisterOp::CLASS:
+                p.reg(a); o << ", " << token->lexeme_;
+                break;
+        }
+
+        o << std::endl;
+    }
+
+    for (auto function: chunk.functions_) {
+        o << std::endl;
+        disassemble(o, *function->registerChunk_, function->name_->lexeme_);
+    }
+}
@@ -0,0 +1,600 @@
+#include "register_compiler.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "lox_exception.hpp"
+
+namespace
+{
+    constexpr size_t MAX_REGISTER = RegisterChunk::CONSTANT - 1;
+    constexpr size_t MAX_LABEL = std::numeric_limits<uint16_t>::max();
+
+    template <typename T>
+    uint16_t add(std::vector<T>& pool, T entry, size_t limit, const char* what)
+    {
+        if (pool.size() > limit) {
+            throw compile_error{std::string{"Too many "} + what + " in one function."};
+        }
+
+        pool.push_back(std::move(entry));
+        return pool.size() - 1;
+    }
+
+    RegisterOp binaryOp(TokenType type)
+    {
+        switch (type) {
+            case TokenType::EQUAL_EQUAL: return RegisterOp::EQUAL;
+            case TokenType::BANG_EQUAL: return RegisterOp::NOT_EQUAL;
+            case TokenType::GREATER: return RegisterOp::GREATER;
+            case TokenType::GREATER_EQUAL: return RegisterOp::GREATER_EQUAL;
+            case TokenType::LESS: return RegisterOp::LESS;
+            case TokenType::LESS_EQUAL: return RegisterOp::LESS_EQUAL;
+            case TokenType::PLUS: return RegisterOp::ADD;
+            case TokenType::MINUS: return RegisterOp::SUBTRACT;
+            case TokenType::STAR: return RegisterOp::MULTIPLY;
+            case TokenType::SLASH: return RegisterOp::DIVIDE;
+            default: throw compile_error{"Unknown binary operator."};
+        }
+    }
+
+    // Whether evaluating the expression may change a variable, through an
+    // assignment or through a function closing over it
+    bool mayAssign(const Expr* expr)
+    {
+        if (dynamic_cast<const AssignExpr*>(expr) || dynamic_cast<const CallExpr*>(expr)) {
+            return true;
+        }
+
+        if (auto binary = dynamic_cast<const BinaryExpr*>(expr)) {
+            return mayAssign(binary->left_.get()) || mayAssign(binary->right_.get());
+        }
+
+        if (auto logical = dynamic_cast<const LogicalExpr*>(expr)) {
+            return mayAssign(logical->left_.get()) || mayAssign(logical->right_.get());
+        }
+
+        if (auto unary = dynamic_cast<const UnaryExpr*>(expr)) {
+            return mayAssign(unary->right_.get());
+        }
+
+        if (auto grouping = dynamic_cast<const GroupingExpr*>(expr)) {
+            return mayAssign(grouping->expression_.get());
+        }
+
+        return false;
+    }
+}
+
+RegisterCompiler::RegisterCompiler(bool repl_mode)
+    : StatementCompiler{repl_mode}
+    , stack_{stackBudget()}
+{ }
+
+RegisterChunkPtr RegisterCompiler::compile(const std::vector<StmtPtr>& statements)
+{
+    auto script = makeRef<RegisterChunk>();
+
+    chunk_ = script.get();
+    top_ = 0;
+    locals_ = 0;
+    slotBase_ = 0;
+    scopes_.clear();
+    loops_.clear();
+    shows_ = 0;
+    stack_.start();
+
+    for (const auto& stmt: statements) {
+        statement(stmt);
+    }
+    emit(RegisterOp::RETURN_NIL);
+
+    chunk_ = nullptr;
+    return script;
+}
+
+void RegisterCompiler::compile(const StmtPtr& stmt)
+{
+    checkNesting();
+    stmt->accept(*this);
+
+    // No temporary outlives its statement
+    top_ = locals_;
+}
+
+void RegisterCompiler::checkNesting() const
+{
+    // Left-associative chains such as `1 + 1 + ...` nest without limit from
+    // the parser
+    if (stack_.exceeded()) {
+        throw compile_error{"Too deeply nested."};
+    }
+}
+
+uint16_t RegisterCompiler::compile(const ExprPtr& expr, int target)
+{
+    auto enclosingTarget = target_;
+    auto mark = top_;
+
+    checkNesting();
+
+    target_ = target;
+    expr->accept(*this);
+    target_ = enclosingTarget;
+
+    // Only a temporary holding the value is kept
+    if (target == ANY && !(operand_ & RegisterChunk::CONSTANT) && operand_ >= mark) {
+        top_ = operand_ + 1;
+    } else {
+        top_ = mark;
+    }
+
+    return operand_;
+}
+
+void RegisterCompiler::emitShow()
+{
+    emit(RegisterOp::SHOW);
+}
+
+uint16_t RegisterCompiler::condition(const ExprPtr& expr)
+{
+    auto operand = compile(expr);
+    result(operand);
+    return operand;
+}
+
+void RegisterCompiler::visitAssignExpr(AssignExprPtr expr)
+{
+    if (expr->slot_ >= 0) {
+        // The value is computed straight into the variable
+        auto reg = slot(expr->slot_);
+
+        compile(expr->value_, reg);
+        produce(reg);
+    } else if (expr->upvalue_ >= 0) {
+        auto value = compile(expr->value_, target_);
+
+        emit(RegisterOp::SET_UPVALUE, expr->upvalue_, value);
+        produce(value);
+    } else {
+        auto value = compile(expr->value_, target_);
+
+        emit(RegisterOp::SET_GLOBAL, global(expr->name_), value);
+        produce(value);
+    }
+}
+
+void RegisterCompiler::visitBinaryExpr(BinaryExprPtr expr)
+{
+    auto mark = top_;
+    auto left = compile(expr->left_);
+
+    // A variable read in place must not see what the right operand does
+    // to it
+    if (left < locals_ && mayAssign(expr->right_.get())) {
+        auto copy = allocate();
+
+        emit(RegisterOp::MOVE, copy, left);
+        left = copy;
+    }
+
+    auto right = compile(expr->right_);
+
+    top_ = mark;
+    auto dest = destination();
+
+    emit(binaryOp(expr->op_->tokenType_), dest, left, right, expr->op_);
+    operand_ = dest;
+}
+
+void RegisterCompiler::visitGroupingExpr(GroupingExprPtr expr)
+{
+    produce(compile(expr->expression_, target_));
+}
+
+void RegisterCompiler::visitLiteralExpr(LiteralExprPtr expr)
+{
+    produce(constant(expr->value_));
+}
+
+void RegisterCompiler::visitUnaryExpr(UnaryExprPtr expr)
+{
+    auto mark = top_;
+    auto right = compile(expr->right_);
+
+    top_ = mark;
+    auto dest = destination();
+
+    if (expr->op_->tokenType_ == TokenType::BANG) {
+        emit(RegisterOp::NOT, dest, right);
+    } else {
+        emit(RegisterOp::NEGATE, dest, right, 0, expr->op_);
+    }
+
+    operand_ = dest;
+}
+
+void RegisterCompiler::visitVariableExpr(VariableExprPtr expr)
+{
+    if (expr->slot_ >= 0) {
+        produce(slot(expr->slot_));
+        return;
+    }
+
+    auto dest = destination();
+
+    if (expr->upvalue_ >= 0) {
+        emit(RegisterOp::GET_UPVALUE, dest, expr->upvalue_);
+    } else {
+        emit(RegisterOp::GET_GLOBAL, dest, global(expr->name_));
+    }
+
+    operand_ = dest;
+}
+
+void RegisterCompiler::visitLogicalExpr(LogicalExprPtr expr)
+{
+    // The operands are evaluated into a temporary unless the value goes to
+    // one, as a variable may be read by the right operand
+    auto dest = target_ != ANY && target_ >= locals_ ? target_ : allocate();
+
+    compile(expr->left_, dest);
+
+    auto end = emit(expr->op_->tokenType_ == TokenType::OR ? RegisterOp::JUMP_IF_TRUE : RegisterOp::JUMP_IF_FALSE, dest);
+
+    compile(expr->right_, dest);
+    patchJump(end);
+
+    produce(dest);
+}
+
+void RegisterCompiler::visitCallExpr(CallExprPtr expr)
+{
+    auto base = callFrame(*expr);
+
+    emit(RegisterOp::CALL, base, expr->args_.size(), 0, expr->paren_);
+
+    top_ = base + 1;
+    produce(base);
+}
+
+void RegisterCompiler::visitWhileStmt(WhileStmtPtr stmt)
+{
+    auto start = chunk_->code_.size();
+
+    auto exit = emit(RegisterOp::JUMP_IF_FALSE, condition(stmt->condition_));
+    top_ = locals_;
+
+    auto loop = loopBody(*stmt, scopes_.size());
+
+    for (auto jump: loop.continues_) {
+        patchJump(jump);
+    }
+
+    if (stmt->increment_) {
+        result(compile(stmt->increment_));
+        top_ = locals_;
+        showIncrement();
+    }
+
+    emit(RegisterOp::LOOP, label(start));
+
+    patchJump(exit);
+
+    for (auto jump: loop.breaks_) {
+        patchJump(jump);
+    }
+}
+
+void RegisterCompiler::visitIfStmt(IfStmtPtr stmt)
+{
+    auto otherwise = emit(RegisterOp::JUMP_IF_FALSE, condition(stmt->condition_));
+    top_ = locals_;
+
+    statement(stmt->thenStmt_);
+
+    if (stmt->elseStmt_) {
+        auto end = emit(RegisterOp::JUMP);
+
+        patchJump(otherwise);
+        statement(stmt->elseStmt_);
+        patchJump(end);
+    } else {
+        patchJump(otherwise);
+    }
+}
+
+void RegisterCompiler::visitBlockStmt(BlockStmtPtr stmt)
+{
+    auto enclosingBase = slotBase_;
+    auto enclosingLocals = locals_;
+
+    if (stmt->scopeSize_ > 0) {
+        // Its frame takes the registers above those in use
+        slotBase_ = top_;
+
+        for (int i = 0; i < stmt->scopeSize_; ++i) {
+            allocate();
+        }
+
+        locals_ = top_;
+    }
+
+    scopes_.push_back(stmt->closeFrom_);
+
+    for (const auto& statement: stmt->statements_) {
+        compile(statement);
+    }
+
+    scopes_.pop_back();
+
+    if (stmt->closeFrom_ >= 0) {
+        emit(RegisterOp::CLOSE_UPVALUES, slot(stmt->closeFrom_));
+    }
+
+    slotBase_ = enclosingBase;
+    locals_ = enclosingLocals;
+}
+
+void RegisterCompiler::visitExpressionStmt(ExpressionStmtPtr stmt)
+{
+    result(compile(stmt->expression_));
+}
+
+void RegisterCompiler::visitPrintStmt(PrintStmtPtr stmt)
+{
+    emit(RegisterOp::PRINT, compile(stmt->expression_));
+}
+
+void RegisterCompiler::visitVarStmt(VarStmtPtr stmt)
+{
+    uint16_t value;
+
+    if (stmt->slot_ >= 0) {
+        value = slot(stmt->slot_);
+
+        if (stmt->initializer_) {
+            compile(stmt->initializer_, value);
+        } else {
+            emit(RegisterOp::LOAD_NIL, value);
+        }
+    } else {
+        value = stmt->initializer_ ? compile(stmt->initializer_) : constant(Value::nil());
+        emit(RegisterOp::DEFINE_GLOBAL, global(stmt->name_), value);
+    }
+
+    // Like the interpreter, only an initializer is a result
+    if (stmt->initializer_) {
+        result(value);
+    }
+}
+
+void RegisterCompiler::visitFunctionStmt(FunctionStmtPtr stmt)
+{
+    if (!stmt->registerChunk_) {
+        compileFunction(*stmt);
+    }
+
+    auto function = add(chunk_->functions_, stmt.get(), MAX_REGISTER, "functions");
+    auto dest = stmt->slot_ >= 0 ? slot(stmt->slot_) : allocate();
+
+    // Captured slots are relative to the frame this code runs in
+    emit(RegisterOp::CLOSURE, dest, function, slotBase_);
+
+    if (stmt->slot_ < 0) {
+        emit(RegisterOp::DEFINE_GLOBAL, global(stmt->name_), dest);
+    }
+}
+
+void RegisterCompiler::visitReturnStmt(ReturnStmtPtr stmt)
+{
+    if (stmt->tailCall_) {
+        auto& call = static_cast<CallExpr&>(*stmt->value_);
+
+        auto base = callFrame(call);
+
+        // The interpreter shows the last argument it evaluated, or the
+        // callee if there are none
+        if (repl_mode_ && shows_ > 0) {
+            result(base + call.args_.size());
+            leaveShows(0);
+        }
+
+        emit(RegisterOp::TAIL_CALL, base, call.args_.size(), 0, call.paren_);
+    } else if (stmt->value_) {
+        auto value = compile(stmt->value_);
+
+        if (repl_mode_ && shows_ > 0) {
+            result(value);
+            leaveShows(0);
+        }
+
+        emit(RegisterOp::RETURN, value);
+    } else {
+        if (repl_mode_ && shows_ > 0) {
+            result(constant(Value::nil()));
+            leaveShows(0);
+        }
+
+        emit(RegisterOp::RETURN_NIL);
+    }
+}
+
+void RegisterCompiler::visitBreakStmt(BreakStmtPtr)
+{
+    auto& loop = loops_.back();
+
+    for (auto scope = scopes_.size(); scope-- > loop.scopes_;) {
+        if (scopes_[scope] >= 0) {
+            emit(RegisterOp::CLOSE_UPVALUES, slot(scopes_[scope]));
+        }
+    }
+
+    leaveShows(loop.shows_);
+    loop.breaks_.push_back(emit(RegisterOp::JUMP));
+}
+
+void RegisterCompiler::visitContinueStmt(ContinueStmtPtr)
+{
+    auto& loop = loops_.back();
+
+    for (auto scope = scopes_.size(); scope-- > loop.scopes_;) {
+        if (scopes_[scope] >= 0) {
+            emit(RegisterOp::CLOSE_UPVALUES, slot(scopes_[scope]));
+        }
+    }
+
+    leaveShows(loop.continueShows_);
+    loop.continues_.push_back(emit(RegisterOp::JUMP));
+}
+
+void RegisterCompiler::visitClassStmt(ClassStmtPtr stmt)
+{
+    auto dest = stmt->slot_ >= 0 ? slot(stmt->slot_) : allocate();
+
+    emit(RegisterOp::CLASS, dest, 0, 0, stmt->name_);
+
+    if (stmt->slot_ < 0) {
+        emit(RegisterOp::DEFINE_GLOBAL, global(stmt->name_), dest);
+    }
+}
+
+void RegisterCompiler::compileFunction(FunctionStmt& stmt)
+{
+    auto enclosing = chunk_;
+    auto enclosingTop = top_;
+    auto enclosingLocals = locals_;
+    auto enclosingBase = slotBase_;
+    auto enclosingScopes = std::move(scopes_);
+    auto enclosingLoops = std::move(loops_);
+    auto enclosingShows = shows_;
+
+    stmt.registerChunk_ = makeRef<RegisterChunk>();
+
+    // The callee's registers start with its arguments, and the rest of its
+    // slots are cleared when it is called
+    chunk_ = stmt.registerChunk_.get();
+    top_ = 0;
+    slotBase_ = 0;
+    scopes_.clear();
+    loops_.clear();
+    shows_ = 0;
+
+    for (int i = 0; i < stmt.scopeSize_; ++i) {
+        allocate();
+    }
+
+    locals_ = top_;
+
+    for (const auto& statement: stmt.body_) {
+        compile(statement);
+    }
+    emit(RegisterOp::RETURN_NIL);
+
+    chunk_ = enclosing;
+    top_ = enclosingTop;
+    locals_ = enclosingLocals;
+    slotBase_ = enclosingBase;
+    scopes_ = std::move(enclosingScopes);
+    loops_ = std::move(enclosingLoops);
+    shows_ = enclosingShows;
+}
+
+uint16_t RegisterCompiler::callFrame(CallExpr& expr)
+{
+    auto base = allocate();
+    compile(expr.callee_, base);
+
+    for (const auto& arg: expr.args_) {
+        compile(arg, allocate());
+    }
+
+    return base;
+}
+
+uint16_t RegisterCompiler::destination()
+{
+    return target_ != ANY ? target_ : allocate();
+}
+
+void RegisterCompiler::produce(uint16_t operand)
+{
+    operand_ = operand;
+
+    if (target_ == ANY || operand == target_) {
+        return;
+    }
+
+    emit(operand & RegisterChunk::CONSTANT ? RegisterOp::LOAD_CONSTANT : RegisterOp::MOVE, target_, operand);
+    operand_ = target_;
+}
+
+void RegisterCompiler::result(uint16_t operand)
+{
+    // Nothing but the REPL looks at the result
+    if (repl_mode_) {
+        emit(RegisterOp::RESULT, operand);
+    }
+}
+
+uint16_t RegisterCompiler::allocate()
+{
+    if (top_ > MAX_REGISTER) {
+        throw compile_error{"Too many registers in one function."};
+    }
+
+    chunk_->registers_ = std::max<size_t>(chunk_->registers_, top_ + 1);
+    return top_++;
+}
+
+size_t RegisterCompiler::emit(RegisterOp op, uint16_t a, uint16_t b, uint16_t c, const TokenPtr& token)
+{
+    chunk_->code_.push_back(Instruction{op, a, b, c});
+    chunk_->tokens_.push_back(token);
+
+    return chunk_->code_.size() - 1;
+}
+
+void RegisterCompiler::patchJump(size_t jump)
+{
+    auto& instruction = chunk_->code_[jump];
+    auto target = label(chunk_->code_.size());
+
+    if (instruction.op_ == RegisterOp::JUMP) {
+        instruction.a_ = target;
+    } else {
+        instruction.b_ = target;
+    }
+}
+
+uint16_t RegisterCompiler::label(size_t index)
+{
+    if (index > MAX_LABEL) {
+        throw compile_error{"Too much code in one function."};
+    }
+
+    return index;
+}
+
+uint16_t RegisterCompiler::slot(int slot)
+{
+    size_t index = slotBase_ + slot;
+
+    if (index > MAX_REGISTER) {
+        throw compile_error{"Too many local variables in one function."};
+    }
+
+    return index;
+}
+
+uint16_t RegisterCompiler::constant(const Value& value)
+{
+    return add(chunk_->constants_, value, MAX_REGISTER, "constants") | RegisterChunk::CONSTANT;
+}
+
+uint16_t RegisterCompiler::global(const TokenPtr& name)
+{
+    // One entry per reference, for the line of an undefined variable error
+    return add(chunk_->globals_, GlobalRef{name}, MAX_LABEL, "globals");
+}
@@ -0,0 +1,434 @@
+#include "register_vm.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "function.hpp"
+#include "lox_class.hpp"
+#include "lox_exception.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO
+#endif
+
+RegisterVM::RegisterVM(Interpreter& interpreter, size_t maxDepth, bool disassemble, size_t maxStackSlots)
+    : interpreter_{interpreter}
+    , compiler_{interpreter.repl_mode_}
+    , maxDepth_{maxDepth}
+    , disassemble_{disassemble}
+    , stack_{interpreter.heap_, maxStackSlots}
+{
+    interpreter_.heap_.addRoots(this);
+}
+
+RegisterVM::~RegisterVM()
+{
+    interpreter_.heap_.removeRoots(this);
+}
+
+void RegisterVM::interpret(const std::vector<StmtPtr>& statements)
+{
+    try {
+        auto script = compiler_.compile(statements);
+
+        if (disassemble_) {
+            disassemble(std::cout, *script, "<script>");
+        }
+
+        if (!growStack(std::max(INITIAL_STACK_SLOTS, script->registers_))) {
+            throw compile_error{"Top-level code needs more registers than there are."};
+        }
+
+        auto registers = stack_.data();
+        std::fill(registers, registers + script->registers_, Value::nil());
+
+        frames_.push_back(CallFrame{nullptr, script.get(), script->code_.data(), registers,
+                                    registers + script->registers_});
+        run();
+    } catch (compile_error& error) {
+        std::cerr << "Compile error: " << error.what() << std::endl;
+    } catch (interpreter_error& error) {
+        reset();
+        interpreter_.abort(error);
+    }
+}
+
+void RegisterVM::run()
+{
+    auto& heap = interpreter_.heap_;
+    auto& global = interpreter_.global_;
+    auto& result = interpreter_.result_;
+
+    auto nil = Value::nil();
+
+    // The innermost frame is kept in locals, and only written back to
+    // frames_ when it makes a call
+    auto frame = &frames_.back();
+    auto function = frame->function_;
+    auto chunk = frame->chunk_;
+    auto ip = frame->ip_;
+    auto registers = frame->registers_;
+    auto constants = chunk->constants_.data();
+
+    // The instruction being run
+    const Instruction* in;
+
+#define RK(operand) ((operand) & RegisterChunk::CONSTANT ? constants[(operand) & ~RegisterChunk::CONSTANT] : registers[operand])
+#define TOKEN() (chunk->tokens_[in - chunk->code_.data()])
+
+    // Makes the function whose arguments start at `args` the running one,
+    // in a new frame record or the innermost one
+    auto enter = [&](LoxFunction* callee, Value* args, bool push) {
+        auto& declaration = *callee->declaration();
+        auto code = declaration.registerChunk_.get();
+
+        size_t argsIndex = args - stack_.data();
+
+        if (argsIndex + code->registers_ > stack_.size()) {
+            if (!growStack(argsIndex + code->registers_)) {
+                throw interpreter_error{TOKEN(), "Stack overflow."};
+            }
+
+            args = stack_.data() + argsIndex;
+        }
+
+        auto top = std::max(frames_.back().top_, args + code->registers_);
+
+        if (push) {
+            frames_.emplace_back();
+        }
+
+        std::fill(args + callee->arity(), args + code->registers_, nil);
+
+        function = callee;
+        chunk = code;
+        constants = code->constants_.data();
+        ip = code->code_.data();
+        registers = args;
+
+        frame = &frames_.back();
+        *frame = CallFrame{function, chunk, ip, registers, top};
+
+        heap.safepoint();
+    };
+
+    // Returns from the running function; false once the top-level code has
+    auto leave = [&](const Value& value) {
+        if (function && function->declaration()->closeFrom_ >= 0) {
+            stack_.closeUpvalues(registers + function->declaration()->closeFrom_);
+        }
+
+        frames_.pop_back();
+
+        if (frames_.empty()) {
+            return false;
+        }
+
+        // The callee's register takes the value
+        registers[-1] = value;
+
+        frame = &frames_.back();
+        function = frame->function_;
+        chunk = frame->chunk_;
+        constants = chunk->constants_.data();
+        ip = frame->ip_;
+        registers = frame->registers_;
+        return true;
+    };
+
+    // Calls anything but a LoxFunction taking these many arguments, which
+    // is either a native or an error
+    auto callOther = [&](const Value& callee, Value* args, uint16_t argc) {
+        interpreter_.checkCallee(TOKEN(), callee, argc);
+
+        try {
+            return callee.as<LoxNative>()->call(interpreter_, std::span<Value>{args, argc});
+        } catch (native_error& error) {
+            throw interpreter_error{TOKEN(), error.what()};
+        }
+    };
+
+#ifdef LOX_COMPUTED_GOTO
+    static const void* const dispatch[] = {
+#define LOX_REGISTER_OP_LABEL(name) &&op_##name,
+        LOX_REGISTER_OPS(LOX_REGISTER_OP_LABEL)
+#undef LOX_REGISTER_OP_LABEL
+    };
+
+#define DISPATCH() in = ip++; goto *dispatch[static_cast<uint8_t>(in->op_)]
+#define TARGET(name) op_##name
+
+    DISPATCH();
+#else
+#define DISPATCH() continue
+#define TARGET(name) case RegisterOp::name
+
+    for (;;) switch (in = ip++, in->op_)
+#endif
+    {
+        TARGET(MOVE):
+        {
+            registers[in->a_] = registers[in->b_];
+            DISPATCH();
+        }
+        TARGET(LOAD_CONSTANT):
+        {
+            registers[in->a_] = RK(in->b_);
+            DISPATCH();
+        }
+        TARGET(LOAD_NIL):
+        {
+            registers[in->a_] = nil;
+            DISPATCH();
+        }
+        TARGET(GET_UPVALUE):
+        {
+            registers[in->a_] = function->upvalue(in->b_)->get();
+            DISPATCH();
+        }
+        TARGET(SET_UPVALUE):
+        {
+            function->upvalue(in->a_)->set(RK(in->b_));
+            DISPATCH();
+        }
+        TARGET(GET_GLOBAL):
+        {
+            auto& ref = chunk->globals_[in->b_];
+            registers[in->a_] = global.get(ref.name_, ref.cell_);
+            DISPATCH();
+        }
+        TARGET(SET_GLOBAL):
+        {
+            auto& ref = chunk->globals_[in->a_];
+            global.assign(ref.name_, ref.cell_, RK(in->b_));
+            DISPATCH();
+        }
+        TARGET(DEFINE_GLOBAL):
+        {
+            global.define(chunk->globals_[in->a_].name_->symbol_, RK(in->b_));
+            DISPATCH();
+        }
+
+        // Operands of the same representation are handled inline, anything
+        // else (and every error) the way the interpreter does
+#define BINARY_OP(intOp, floatOp)                                                   \
+        {                                                                           \
+            auto left = RK(in->b_);                                                 \
+            auto right = RK(in->c_);                                                \
+                                                                                    \
+            if (left.isSmallInt() && right.isSmallInt()) {                          \
+                auto a = left.asSmallInt(), b = right.asSmallInt();                 \
+                registers[in->a_] = intOp;                                          \
+            } else if (left.isFloat() && right.isFloat()) {                         \
+                auto a = left.asDouble(), b = right.asDouble();                     \
+                registers[in->a_] = floatOp;                                        \
+            } else {                                                                \
+                interpreter_.applyBinary(TOKEN(), left, right);                     \
+                registers[in->a_] = result;                                         \
+            }                                                                       \
+            DISPATCH();                                                             \
+        }
+
+        TARGET(EQUAL):
+        {
+            registers[in->a_] = Value::boolean(interpreter_.isEqual(RK(in->b_), RK(in->c_)));
+            DISPATCH();
+        }
+        TARGET(NOT_EQUAL):
+        {
+            registers[in->a_] = Value::boolean(!interpreter_.isEqual(RK(in->b_), RK(in->c_)));
+            DISPATCH();
+        }
+        TARGET(GREATER):
+            BINARY_OP(Value::boolean(a > b), Value::boolean(a > b))
+        TARGET(GREATER_EQUAL):
+            BINARY_OP(Value::boolean(a >= b), Value::boolean(a >= b))
+        TARGET(LESS):
+            BINARY_OP(Value::boolean(a < b), Value::boolean(a < b))
+        TARGET(LESS_EQUAL):
+            BINARY_OP(Value::boolean(a <= b), Value::boolean(a <= b))
+        TARGET(ADD):
+            BINARY_OP(Value::integer(a + b, heap), Value::number(a + b))
+        TARGET(SUBTRACT):
+            BINARY_OP(Value::integer(a - b, heap), Value::number(a - b))
+        TARGET(MULTIPLY):
+            BINARY_OP(Value::integer(a * b, heap), Value::number(a * b))
+#undef BINARY_OP
+        TARGET(DIVIDE):
+        {
+            // Division by zero is checked by the interpreter
+            interpreter_.applyBinary(TOKEN(), RK(in->b_), RK(in->c_));
+            registers[in->a_] = result;
+            DISPATCH();
+        }
+        TARGET(NOT):
+        {
+            registers[in->a_] = Value::boolean(!interpreter_.isTruthy(RK(in->b_)));
+            DISPATCH();
+        }
+        TARGET(NEGATE):
+        {
+            auto value = RK(in->b_);
+
+            if (value.isSmallInt()) {
+                registers[in->a_] = Value::integer(-value.asSmallInt(), heap);
+            } else if (value.isFloat()) {
+                registers[in->a_] = Value::number(-value.asDouble());
+            } else {
+                interpreter_.applyUnary(TOKEN(), value);
+                registers[in->a_] = result;
+            }
+            DISPATCH();
+        }
+        TARGET(RESULT):
+        {
+            result = RK(in->a_);
+            DISPATCH();
+        }
+        TARGET(PRINT):
+        {
+            result = RK(in->a_);
+            std::cout << result << std::endl;
+            DISPATCH();
+        }
+        TARGET(SHOW):
+        {
+            std::cout << result << std::endl;
+            DISPATCH();
+        }
+        TARGET(JUMP):
+        {
+            ip = chunk->code_.data() + in->a_;
+            DISPATCH();
+        }
+        TARGET(JUMP_IF_FALSE):
+        {
+            if (!interpreter_.isTruthy(RK(in->a_))) {
+                ip = chunk->code_.data() + in->b_;
+            }
+            DISPATCH();
+        }
+        TARGET(JUMP_IF_TRUE):
+        {
+            if (interpreter_.isTruthy(RK(in->a_))) {
+                ip = chunk->code_.data() + in->b_;
+            }
+            DISPATCH();
+        }
+        TARGET(LOOP):
+        {
+            ip = chunk->code_.data() + in->a_;
+
+            heap.safepoint();
+            DISPATCH();
+        }
+        TARGET(CALL):
+        {
+            auto base = registers + in->a_;
+            auto argc = in->b_;
+            auto callee = *base;
+
+            if (callee.isObjType(ObjType::FUNCTION) && callee.as<LoxFunction>()->arity() == argc) {
+                if (frames_.size() > maxDepth_) {
+                    throw interpreter_error{TOKEN(), "Stack overflow."};
+                }
+
+                frame->ip_ = ip;
+                enter(callee.as<LoxFunction>(), base + 1, true);
+            } else {
+                *base = callOther(callee, base + 1, argc);
+            }
+            DISPATCH();
+        }
+        TARGET(TAIL_CALL):
+        {
+            auto base = registers + in->a_;
+            auto argc = in->b_;
+            auto callee = *base;
+
+            if (callee.isObjType(ObjType::FUNCTION) && callee.as<LoxFunction>()->arity() == argc) {
+                // The callee and its arguments replace the caller's frame
+                if (function->declaration()->closeFrom_ >= 0) {
+                    stack_.closeUpvalues(registers + function->declaration()->closeFrom_);
+                }
+
+                std::copy(base, base + argc + 1, registers - 1);
+
+                enter(callee.as<LoxFunction>(), registers, false);
+                DISPATCH();
+            }
+
+            if (!leave(callOther(callee, base + 1, argc))) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(RETURN):
+        {
+            if (!leave(RK(in->a_))) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(RETURN_NIL):
+        {
+            if (!leave(nil)) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(CLOSURE):
+        {
+            auto stmt = chunk->functions_[in->b_];
+            auto base = registers + in->c_;
+
+            std::vector<Upvalue*> upvalues;
+            upvalues.reserve(stmt->captures_.size());
+
+            for (const auto& capture: stmt->captures_) {
+                upvalues.push_back(capture.local_ ? stack_.captureUpvalue(base + capture.index_) : function->upvalue(capture.index_));
+            }
+
+            registers[in->a_] = Value{heap.make<LoxFunction>(FunctionStmtPtr{stmt}, std::move(upvalues))};
+            DISPATCH();
+        }
+        TARGET(CLASS):
+        {
+            registers[in->a_] = Value{heap.make<LoxClass>(TOKEN()->lexeme_)};
+            DISPATCH();
+        }
+        TARGET(CLOSE_UPVALUES):
+        {
+            stack_.closeUpvalues(registers + in->a_);
+            DISPATCH();
+        }
+    }
+
+#undef DISPATCH
+#undef TARGET
+#undef TOKEN
+#undef RK
+}
+
+bool RegisterVM::growStack(size_t slots)
+{
+    return stack_.grow(slots, [this](auto rebase) {
+        for (auto& frame: frames_) {
+            rebase(frame.registers_);
+            rebase(frame.top_);
+        }
+    });
+}
+
+void RegisterVM::reset()
+{
+    // The frames are gone, but closures may still be reachable
+    stack_.closeUpvalues(stack_.data());
+
+    frames_.clear();
+}
+
+void RegisterVM::markRoots(Heap& heap)
+{
+    stack_.markRoots(heap, frames_.empty() ? stack_.data() : frames_.back().top_);
+}
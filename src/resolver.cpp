@@ -1,17 +1,26 @@
 #include "resolver.hpp"
 
+#include <algorithm>
 #include <iostream>
 
-#include "interpreter.hpp"
-
-Resolver::Resolver(Interpreter& interpreter)
-    : interpreter_{interpreter}
-{ }
+namespace
+{
+    bool declaresVariables(const std::vector<StmtPtr>& stmts)
+    {
+        for (const auto& stmt: stmts) {
+            if (dynamic_cast<VarStmt*>(stmt.get()) || dynamic_cast<FunctionStmt*>(stmt.get())
+                || dynamic_cast<ClassStmt*>(stmt.get())) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
 
 void Resolver::visitAssignExpr(AssignExprPtr expr)
 {
     resolve(expr->value_);
-    resolveLocal(expr, expr->name_);
+    resolveLocal(expr->name_, expr->slot_, expr->upvalue_);
 }
 
 void Resolver::visitBinaryExpr(BinaryExprPtr expr)
@@ -38,14 +47,15 @@ void Resolver::visitUnaryExpr(UnaryExprPtr expr)
 void Resolver::visitVariableExpr(VariableExprPtr expr)
 {
     if (!scopes_.empty()) {
-        auto it = scopes_.back().find(expr->name_->lexeme_);
-        if (it != scopes_.back().end() && !it->second) {
+        auto& locals = scopes_.back().locals_;
+        auto it = locals.find(expr->name_->symbol_);
+        if (it != locals.end() && !it->second.defined_) {
             std::cerr << "Line [" << expr->name_->line_ << "]: Can't read local variable in its own initializer." << std::endl;
             has_error_ = true;
         }
     }
 
-    resolveLocal(expr, expr->name_);
+    resolveLocal(expr->name_, expr->slot_, expr->upvalue_);
 }
 
 void Resolver::visitLogicalExpr(LogicalExprPtr expr)
@@ -58,15 +68,22 @@ void Resolver::visitCallExpr(CallExprPtr expr)
 {
     resolve(expr->callee_);
 
-    for (auto args: *expr->args_) {
-        resolve(args);
+    for (const auto& arg: expr->args_) {
+        resolve(arg);
     }
 }
 
 void Resolver::visitWhileStmt(WhileStmtPtr stmt)
 {
     resolve(stmt->condition_);
+
+    ++loopDepth_;
     resolve(stmt->statements_);
+    --loopDepth_;
+
+    if (stmt->increment_) {
+        resolve(stmt->increment_);
+    }
 }
 
 void Resolver::visitIfStmt(IfStmtPtr stmt)
@@ -81,9 +98,26 @@ void Resolver::visitIfStmt(IfStmtPtr stmt)
 
 void Resolver::visitBlockStmt(BlockStmtPtr stmt)
 {
-    beginScope();
+    // The variables of a block live in the frame of the enclosing function.
+    // Only top-level blocks need a frame of their own.
+    auto ownsFrame = declaresVariables(stmt->statements_) && !hasFrame();
+
+    beginScope(ownsFrame);
     resolve(stmt->statements_);
-    endScope();
+    auto scope = endScope();
+
+    // A block with no frame of its own is left with a size of 0
+    if (ownsFrame) {
+        stmt->scopeSize_ = scope.size_;
+    }
+
+    // Captured variables are closed over when the block exits, so that every
+    // run of it gets fresh ones
+    for (const auto& [name, local]: scope.locals_) {
+        if (local.captured_ && (stmt->closeFrom_ < 0 || local.slot_ < stmt->closeFrom_)) {
+            stmt->closeFrom_ = local.slot_;
+        }
+    }
 }
 
 void Resolver::visitExpressionStmt(ExpressionStmtPtr stmt)
@@ -98,7 +132,7 @@ void Resolver::visitPrintStmt(PrintStmtPtr stmt)
 
 void Resolver::visitVarStmt(VarStmtPtr stmt)
 {
-    declare(stmt->name_);
+    stmt->slot_ = declare(stmt->name_);
     
     if (stmt->initializer_) {
         resolve(stmt->initializer_);
@@ -109,7 +143,7 @@ void Resolver::visitVarStmt(VarStmtPtr stmt)
 
 void Resolver::visitFunctionStmt(FunctionStmtPtr stmt)
 {
-    declare(stmt->name_);
+    stmt->slot_ = declare(stmt->name_);
     define(stmt->name_);
 
     resolveFunction(stmt, FunctionType::FUNCTION);
@@ -124,93 +158,186 @@ void Resolver::visitReturnStmt(ReturnStmtPtr stmt)
 
     if (stmt->value_) {
         resolve(stmt->value_);
+
+        stmt->tailCall_ = dynamic_cast<CallExpr*>(stmt->value_.get()) != nullptr;
     }
 }
 
-void Resolver::visitClassStmt(ClassStmtPtr stmt)
+void Resolver::visitBreakStmt(BreakStmtPtr stmt)
 {
-    declare(stmt->name_);
-    define(stmt->name_);
+    if (loopDepth_ == 0) {
+        std::cerr << "Line [" << stmt->keyword_->line_ << "]: Can't use 'break' outside of a loop." << std::endl;
+        has_error_ = true;
+    }
 }
 
-void Resolver::resolve(std::shared_ptr<std::vector<StmtPtr>> stmts)
+void Resolver::visitContinueStmt(ContinueStmtPtr stmt)
 {
-    for (auto stmt: *stmts) {
-        resolve(stmt);
+    if (loopDepth_ == 0) {
+        std::cerr << "Line [" << stmt->keyword_->line_ << "]: Can't use 'continue' outside of a loop." << std::endl;
+        has_error_ = true;
     }
 }
 
-void Resolver::resolve(StmtPtr stmt)
+void Resolver::visitClassStmt(ClassStmtPtr stmt)
+{
+    stmt->slot_ = declare(stmt->name_);
+    define(stmt->name_);
+}
+
+void Resolver::resolve(const StmtPtr& stmt)
 {
     stmt->accept(*this);
 }
 
-void Resolver::resolve(ExprPtr expr)
+void Resolver::resolve(const ExprPtr& expr)
 {
     expr->accept(*this);
 }
 
-void Resolver::resolveLocal(ExprPtr expr, TokenPtr name)
+// Globals are left unresolved, with neither a slot nor an upvalue
+void Resolver::resolveLocal(const TokenPtr& name, int& slot, int& upvalue)
+{
+    auto current = functions_.size() - 1;
+
+    if (auto local = findLocal(current, name)) {
+        slot = local->slot_;
+    } else {
+        upvalue = resolveUpvalue(current, name);
+    }
+}
+
+Resolver::Local* Resolver::findLocal(size_t function, const TokenPtr& name)
+{
+    auto end = function + 1 < functions_.size() ? functions_[function + 1].firstScope_ : scopes_.size();
+
+    for (auto i = end; i > functions_[function].firstScope_; --i) {
+        auto it = scopes_[i - 1].locals_.find(name->symbol_);
+
+        if (it != scopes_[i - 1].locals_.end()) {
+            return &it->second;
+        }
+    }
+
+    return nullptr;
+}
+
+// Returns the index of the upvalue through which `function` reaches a
+// variable of an enclosing function, adding it to the captures of every
+// function in between, or -1 for a global
+int Resolver::resolveUpvalue(size_t function, const TokenPtr& name)
+{
+    if (function == 0) return -1;
+
+    if (auto local = findLocal(function - 1, name)) {
+        local->captured_ = true;
+
+        // Escape analysis: the frame of the enclosing function now has to
+        // close this slot's upvalue on return
+        if (auto enclosing = functions_[function - 1].declaration_) {
+            if (enclosing->closeFrom_ < 0 || local->slot_ < enclosing->closeFrom_) {
+                enclosing->closeFrom_ = local->slot_;
+            }
+        }
+
+        return addCapture(function, Capture{true, local->slot_});
+    }
+
+    auto index = resolveUpvalue(function - 1, name);
+
+    if (index < 0) return -1;
+
+    return addCapture(function, Capture{false, index});
+}
+
+int Resolver::addCapture(size_t function, Capture capture)
 {
-    for (int i = scopes_.size() - 1; i >= 0; --i) {
-        if (scopes_.at(i).contains(name->lexeme_)) {
-            interpreter_.resolve(expr, scopes_.size() - i - 1);
-            return;
+    auto& captures = functions_[function].declaration_->captures_;
+
+    for (size_t i = 0; i < captures.size(); ++i) {
+        if (captures[i].local_ == capture.local_ && captures[i].index_ == capture.index_) {
+            return i;
         }
     }
+
+    captures.push_back(capture);
+    return captures.size() - 1;
 }
 
-void Resolver::resolveFunction(FunctionStmtPtr stmt, FunctionType type)
+void Resolver::resolveFunction(const FunctionStmtPtr& stmt, FunctionType type)
 {
     auto previousType = currentFunction;
     currentFunction = type;
 
-    beginScope();
+    auto enclosingLoops = loopDepth_;
+    loopDepth_ = 0;
+
+    functions_.push_back({stmt.get(), scopes_.size()});
+    beginScope(true);
 
-    for (auto param: *stmt->params_) {
+    for (const auto& param: stmt->params_) {
         declare(param);
         define(param);
     }
     resolve(stmt->body_);
 
-    endScope();
+    stmt->scopeSize_ = endScope().size_;
+    functions_.pop_back();
 
+    loopDepth_ = enclosingLoops;
     currentFunction = previousType;
 }
 
-void Resolver::beginScope()
+void Resolver::beginScope(bool ownsFrame)
 {
-    scopes_.push_back({});
+    auto firstSlot = ownsFrame || scopes_.empty() ? 0 : scopes_.back().nextSlot_;
+    scopes_.push_back(Scope{{}, ownsFrame, firstSlot, firstSlot});
 }
 
-void Resolver::endScope()
+Resolver::Scope Resolver::endScope()
 {
+    auto scope = std::move(scopes_.back());
     scopes_.pop_back();
+
+    if (!scope.ownsFrame_ && !scopes_.empty()) {
+        auto& enclosing = scopes_.back();
+        enclosing.size_ = std::max(enclosing.size_, scope.size_);
+    }
+
+    return scope;
 }
 
-void Resolver::declare(TokenPtr name)
+bool Resolver::hasFrame() const
 {
-    if (scopes_.empty()) return;
+    return std::any_of(scopes_.begin(), scopes_.end(), [](const Scope& scope) { return scope.ownsFrame_; });
+}
+
+int Resolver::declare(const TokenPtr& name)
+{
+    if (scopes_.empty()) return -1;
 
     auto& scope = scopes_.back();
+    auto [it, inserted] = scope.locals_.try_emplace(name->symbol_, Local{scope.nextSlot_, false, false});
 
-    if (scope.contains(name->lexeme_)) {
+    if (inserted) {
+        scope.size_ = std::max(scope.size_, ++scope.nextSlot_);
+    } else {
         std::cerr << "Line [" << name->line_ << "]: Already a variable with this name in this scope" << std::endl;
         has_error_ = true;
     }
 
-    scope.insert({name->lexeme_, false});
+    return it->second.slot_;
 }
 
-void Resolver::define(TokenPtr name)
+void Resolver::define(const TokenPtr& name)
 {
     if (scopes_.empty()) return;
-    scopes_.back().insert_or_assign(name->lexeme_, true);
+    scopes_.back().locals_.find(name->symbol_)->second.defined_ = true;
 }
 
 bool Resolver::resolve(const std::vector<StmtPtr>& stmts)
 {
-    for (auto stmt: stmts) {
+    for (const auto& stmt: stmts) {
         resolve(stmt);
     }
 
@@ -30,7 +30,7 @@ namespace
 
 void Runner::run()
 {
-    Scanner scanner{source_};
+    Scanner scanner{source_, interpreter_.heap_, interpreter_.strings_};
 
     auto tokens = scanner.scanTokens();
 
@@ -38,7 +38,7 @@ void Runner::run()
         return;
     }
 
-    Parser parser{tokens.value()};
+    Parser parser{tokens.value(), maxNesting_};
 
     auto ast = parser.parse();
 
@@ -46,13 +46,39 @@ void Runner::run()
         return;
     }
 
-    Resolver resolver{interpreter_};
+    Resolver resolver;
         
     if (!resolver.resolve(ast.value())) {
         return;
     }
-    
-    interpreter_.interpret(ast.value());
+
+    switch (engine_) {
+        case Engine::TREE:
+        {
+            interpreter_.interpret(ast.value());
+            break;
+        }
+        case Engine::STACK:
+        {
+            stackEvaluator_.interpret(ast.value());
+            break;
+        }
+        case Engine::BYTECODE:
+        {
+            vm_.interpret(ast.value());
+            break;
+        }
+        case Engine::REGISTER:
+        {
+            registerVM_.interpret(ast.value());
+            break;
+        }
+        case Engine::CLOSURE:
+        {
+            closureCompiler_.interpret(ast.value());
+            break;
+        }
+    }
 }
 
 void Runner::runFromFile(const char *file)
@@ -61,6 +87,23 @@ void Runner::runFromFile(const char *file)
     run();
 }
 
+void Runner::printStats(std::ostream& o)
+{
+    auto& values = Value::stats();
+
+    o << "Values created inline: " << values.inline_ << " (allocations avoided)" << std::endl;
+    o << "Values boxed on the heap: " << values.boxed_ << std::endl;
+
+    auto& calls = CallCache::stats();
+
+    o << "Call cache hits: " << calls.hits_ << ", misses: " << calls.misses_
+      << " (megamorphic: " << calls.megamorphic_ << "), flushes: " << calls.flushes_ << std::endl;
+
+    o << "Interned strings: " << interpreter_.strings_.size() << std::endl;
+
+    interpreter_.heap_.printStats(o);
+}
+
 void Runner::runFromPrompt()
 {
     std::cout << "Lox REPL" << std::endl;
@@ -6,7 +6,9 @@
 namespace {
     const static std::unordered_map<std::string, TokenType> reservedIdentifiers = {
         { "and", TokenType::AND},
+        { "break", TokenType::BREAK},
         { "class", TokenType::CLASS},
+        { "continue", TokenType::CONTINUE},
         { "else", TokenType::ELSE},
         { "false", TokenType::FALSE},
         { "fun", TokenType::FUN},
@@ -24,8 +26,10 @@ namespace {
     };
 }
 
-Scanner::Scanner(const std::string& program)
+Scanner::Scanner(const std::string& program, Heap& heap, StringTable& strings)
     : program_{program}
+    , heap_{heap}
+    , strings_{strings}
 {
 }
 
@@ -64,7 +68,7 @@ bool Scanner::match(char c)
 
 void Scanner::addToken(TokenType tokenType)
 {
-    addToken(tokenType, nullptr);
+    addToken(tokenType, Value::nil());
 }
 
 void Scanner::parseString()
@@ -86,7 +90,7 @@ void Scanner::parseString()
     advance();
 
     std::string value = program_.substr(start_ + 1, (current_ - start_ - 2));
-    addToken(TokenType::STRING, std::make_shared<LoxString>(value));
+    addToken(TokenType::STRING, Value{strings_.intern(value)});
 }
 
 void Scanner::parseNumber()
@@ -107,9 +111,9 @@ void Scanner::parseNumber()
 
     std::string value = program_.substr(start_, (current_ - start_));
     if (isFloat) {
-        addToken(TokenType::NUMBER, std::make_shared<LoxFloat>(std::stod(value)));
+        addToken(TokenType::NUMBER, Value::number(std::stod(value)));
     } else {
-        addToken(TokenType::NUMBER, std::make_shared<LoxInteger>(std::stoll(value)));
+        addToken(TokenType::NUMBER, Value::integerConstant(std::stoll(value), heap_));
     }
 }
 
@@ -131,6 +135,10 @@ void Scanner::parseIdentifier()
     }
 
     addToken(tokenType);
+
+    if (tokenType == TokenType::IDENTIFIER) {
+        tokens_.back()->symbol_ = strings_.intern(value);
+    }
 }
 
 bool Scanner::isNum(char c)
@@ -0,0 +1,179 @@
+#include "slab_allocator.hpp"
+
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <ostream>
+
+// Under AddressSanitizer, free slots are poisoned so that a use after free
+// (e.g. of an object the collector reclaimed) is reported even though the
+// memory stays with the allocator.
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+#define UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define POISON(ptr, size) ((void)(ptr), (void)(size))
+#define UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+SlabAllocator::~SlabAllocator()
+{
+    for (auto& sizeClass: classes_) {
+        auto slab = sizeClass.slabs_;
+        while (slab) {
+            auto next = slab->next_;
+            std::free(slab);
+            slab = next;
+        }
+    }
+
+    auto slab = largeSlabs_;
+    while (slab) {
+        auto next = slab->next_;
+        std::free(slab);
+        slab = next;
+    }
+}
+
+auto SlabAllocator::slabOf(void* ptr) -> Slab*
+{
+    return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t{SLAB_SIZE} - 1));
+}
+
+size_t SlabAllocator::classSize(uint32_t sizeClass)
+{
+    return (sizeClass + 1) * GRANULE;
+}
+
+auto SlabAllocator::newSlab(uint32_t sizeClass, size_t bytes) -> Slab*
+{
+    auto memory = std::aligned_alloc(SLAB_SIZE, bytes);
+    if (!memory) {
+        throw std::bad_alloc{};
+    }
+
+    auto slab = new (memory) Slab{this, nullptr, sizeClass, 0};
+
+    return slab;
+}
+
+void* SlabAllocator::allocate(size_t size)
+{
+    ++allocations_;
+
+    if (size > MAX_SMALL_SIZE) {
+        return allocateLarge(size);
+    }
+
+    auto index = static_cast<uint32_t>((size + GRANULE - 1) / GRANULE - 1);
+    auto& sizeClass = classes_[index];
+
+    void* ptr;
+
+    if (sizeClass.freeList_) {
+        ptr = sizeClass.freeList_;
+        UNPOISON(ptr, classSize(index));
+        sizeClass.freeList_ = sizeClass.freeList_->next_;
+        ++reused_;
+    } else {
+        if (sizeClass.cursor_ == sizeClass.end_) {
+            auto slab = newSlab(index, SLAB_SIZE);
+            slab->next_ = sizeClass.slabs_;
+            sizeClass.slabs_ = slab;
+            ++sizeClass.slabCount_;
+
+            auto base = reinterpret_cast<char*>(slab);
+            auto objects = (SLAB_SIZE - HEADER_SIZE) / classSize(index);
+            sizeClass.cursor_ = base + HEADER_SIZE;
+            sizeClass.end_ = sizeClass.cursor_ + objects * classSize(index);
+        }
+
+        ptr = sizeClass.cursor_;
+        sizeClass.cursor_ += classSize(index);
+    }
+
+    ++slabOf(ptr)->live_;
+    ++sizeClass.live_;
+
+    return ptr;
+}
+
+void* SlabAllocator::allocateLarge(size_t size)
+{
+    // Large objects get a slab of their own, so that the header can still be
+    // found by masking the object's address.
+    auto bytes = (HEADER_SIZE + size + SLAB_SIZE - 1) / SLAB_SIZE * SLAB_SIZE;
+
+    auto slab = newSlab(LARGE_CLASS, bytes);
+    slab->live_ = 1;
+    slab->next_ = largeSlabs_;
+    largeSlabs_ = slab;
+    ++largeLive_;
+
+    return reinterpret_cast<char*>(slab) + HEADER_SIZE;
+}
+
+void SlabAllocator::deallocate(void* ptr)
+{
+    if (!ptr) return;
+
+    auto slab = slabOf(ptr);
+    slab->owner_->free(slab, ptr);
+}
+
+void SlabAllocator::free(Slab* slab, void* ptr)
+{
+    if (slab->sizeClass_ == LARGE_CLASS) {
+        auto link = &largeSlabs_;
+        while (*link != slab) {
+            link = &(*link)->next_;
+        }
+        *link = slab->next_;
+        --largeLive_;
+
+        std::free(slab);
+        return;
+    }
+
+    auto& sizeClass = classes_[slab->sizeClass_];
+
+    auto node = static_cast<FreeNode*>(ptr);
+    node->next_ = sizeClass.freeList_;
+    sizeClass.freeList_ = node;
+
+    POISON(ptr, classSize(slab->sizeClass_));
+
+    --slab->live_;
+    --sizeClass.live_;
+}
+
+void SlabAllocator::printStats(std::ostream& o) const
+{
+    size_t slabs = 0, live = 0;
+    for (auto& sizeClass: classes_) {
+        slabs += sizeClass.slabCount_;
+        live += sizeClass.live_;
+    }
+
+    o << "Slab allocator: " << slabs << " slab(s) of " << SLAB_SIZE / 1024 << " KiB, "
+      << live << " live object(s), " << allocations_ << " allocation(s), "
+      << reused_ << " served from free lists" << std::endl;
+
+    for (uint32_t i = 0; i < NUM_CLASSES; ++i) {
+        auto& sizeClass = classes_[i];
+        if (sizeClass.slabCount_ == 0) continue;
+
+        auto capacity = sizeClass.slabCount_ * ((SLAB_SIZE - HEADER_SIZE) / classSize(i));
+        auto permille = sizeClass.live_ * 1000 / capacity;
+
+        o << "  " << std::setw(4) << classSize(i) << " bytes: "
+          << sizeClass.slabCount_ << " slab(s), "
+          << sizeClass.live_ << "/" << capacity << " slots in use ("
+          << permille / 10 << '.' << permille % 10 << "%)" << std::endl;
+    }
+
+    if (largeLive_) {
+        o << "  large: " << largeLive_ << " object(s)" << std::endl;
+    }
+}
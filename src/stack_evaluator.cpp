@@ -0,0 +1,504 @@
+#include "stack_evaluator.hpp"
+
+#include <iostream>
+
+#include "function.hpp"
+#include "lox_exception.hpp"
+
+StackEvaluator::StackEvaluator(Interpreter& interpreter, size_t maxDepth)
+    : interpreter_{interpreter}
+    , maxDepth_{maxDepth}
+{ }
+
+void StackEvaluator::interpret(const std::vector<StmtPtr>& statements)
+{
+    try {
+        for (const auto& statement: statements) {
+            interpreter_.heap_.safepoint();
+            pushStatement(statement.get());
+            run();
+        }
+    } catch (interpreter_error& error) {
+        tasks_.clear();
+        depth_ = 0;
+
+        interpreter_.abort(error);
+    }
+}
+
+void StackEvaluator::run()
+{
+    auto& result = interpreter_.result_;
+    auto& stack = interpreter_.stack_;
+
+    while (!tasks_.empty()) {
+        auto task = tasks_.back();
+        tasks_.pop_back();
+
+        switch (task.op_) {
+            case Op::EVAL:
+            {
+                task.expr_->accept(*this);
+                break;
+            }
+            case Op::EXEC:
+            {
+                task.stmt_->accept(*this);
+                break;
+            }
+            case Op::SHOW:
+            {
+                std::cout << result << std::endl;
+                break;
+            }
+            case Op::PUSH:
+            {
+                stack.push_back(result);
+                break;
+            }
+            case Op::ASSIGN:
+            {
+                interpreter_.assign(static_cast<AssignExpr&>(*task.expr_), result);
+                break;
+            }
+            case Op::BINARY:
+            {
+                auto& expr = static_cast<BinaryExpr&>(*task.expr_);
+                auto left = stack.back();
+                auto right = result;
+                stack.pop_back();
+
+                interpreter_.applyBinary(expr, left, right);
+                break;
+            }
+            case Op::UNARY:
+            {
+                auto right = result;
+                interpreter_.applyUnary(static_cast<UnaryExpr&>(*task.expr_).op_, right);
+                break;
+            }
+            case Op::LOGICAL:
+            {
+                auto& expr = static_cast<LogicalExpr&>(*task.expr_);
+
+                // `or` stops at the first truthy operand, `and` at the first falsy one
+                if (interpreter_.isTruthy(result) != (expr.op_->tokenType_ == TokenType::OR)) {
+                    push(Op::EVAL, expr.right_.get());
+                }
+                break;
+            }
+            case Op::CALL:
+            {
+                call(static_cast<CallExpr&>(*task.expr_));
+                break;
+            }
+            case Op::TAIL_CALL:
+            {
+                tailCall(static_cast<CallExpr&>(*task.expr_));
+                break;
+            }
+            case Op::PRINT:
+            {
+                std::cout << result << std::endl;
+                break;
+            }
+            case Op::VAR:
+            {
+                auto& stmt = static_cast<VarStmt&>(*task.stmt_);
+                interpreter_.declare(stmt.slot_, stmt.name_, result);
+                break;
+            }
+            case Op::IF:
+            {
+                auto& stmt = static_cast<IfStmt&>(*task.stmt_);
+
+                if (interpreter_.isTruthy(result)) {
+                    pushStatement(stmt.thenStmt_.get());
+                } else if (stmt.elseStmt_) {
+                    pushStatement(stmt.elseStmt_.get());
+                }
+                break;
+            }
+            case Op::WHILE:
+            {
+                auto& stmt = static_cast<WhileStmt&>(*task.stmt_);
+
+                if (interpreter_.isTruthy(result)) {
+                    push(Op::LOOP, &stmt);
+
+                    // The body of a for loop is shown with its increment
+                    if (stmt.increment_) {
+                        push(Op::EXEC, stmt.statements_.get());
+                    } else {
+                        pushStatement(stmt.statements_.get());
+                    }
+                }
+                break;
+            }
+            case Op::RETURN:
+            {
+                unwind(Op::POP_CALL);
+                break;
+            }
+            case Op::BLOCK:
+            {
+                auto& statements = *task.statements_;
+                auto stmt = statements[task.index_].get();
+
+                if (task.index_ + 1 < statements.size()) {
+                    ++task.index_;
+                    tasks_.push_back(task);
+                }
+
+                interpreter_.heap_.safepoint();
+                stmt->accept(*this);
+                break;
+            }
+            case Op::LOOP:
+            {
+                // The body is done, or has been left by `continue`
+                auto& stmt = static_cast<WhileStmt&>(*task.stmt_);
+                interpreter_.heap_.safepoint();
+
+                push(Op::WHILE, &stmt);
+                push(Op::EVAL, stmt.condition_.get());
+
+                if (stmt.increment_) {
+                    if (interpreter_.repl_mode_) {
+                        push(Op::SHOW);
+                    }
+                    push(Op::EVAL, stmt.increment_.get());
+                }
+                break;
+            }
+            case Op::CLOSE:
+            {
+                interpreter_.openUpvalues_.close(interpreter_.frame_ + task.index_);
+                break;
+            }
+            case Op::POP_FRAME:
+            {
+                popFrame(task);
+                break;
+            }
+            case Op::POP_CALL:
+            {
+                // The body ran to its end without returning anything
+                result = Value::nil();
+                popCall(task);
+                break;
+            }
+        }
+    }
+}
+
+void StackEvaluator::pushBlock(const std::vector<StmtPtr>& statements)
+{
+    if (!statements.empty()) {
+        tasks_.push_back(Task{Op::BLOCK, {.statements_ = &statements}, 0});
+    }
+}
+
+void StackEvaluator::pushStatement(Stmt* stmt)
+{
+    if (interpreter_.repl_mode_) {
+        push(Op::SHOW);
+    }
+
+    push(Op::EXEC, stmt);
+}
+
+void StackEvaluator::pushCall(CallExpr* call, Op op)
+{
+    // Evaluates the callee and the arguments in order onto the value stack,
+    // as Interpreter::prepareCall does
+    push(op, call);
+
+    for (auto arg = call->args_.rbegin(); arg != call->args_.rend(); ++arg) {
+        push(Op::PUSH);
+        push(Op::EVAL, arg->get());
+    }
+
+    push(Op::PUSH);
+    push(Op::EVAL, call->callee_.get());
+}
+
+void StackEvaluator::call(CallExpr& expr)
+{
+    auto& stack = interpreter_.stack_;
+    auto base = stack.size() - expr.args_.size() - 1;
+
+    auto callee = interpreter_.checkCall(expr, base);
+
+    if (callee.function_) {
+        enterFunction(expr, callee.function_, base + 1);
+    } else {
+        interpreter_.result_ = interpreter_.finishCall(expr, base, callee);
+    }
+}
+
+void StackEvaluator::tailCall(CallExpr& expr)
+{
+    auto& stack = interpreter_.stack_;
+    auto base = stack.size() - expr.args_.size() - 1;
+
+    auto callee = interpreter_.checkCall(expr, base);
+
+    if (!callee.function_) {
+        interpreter_.result_ = interpreter_.finishCall(expr, base, callee);
+        unwind(Op::POP_CALL);
+        return;
+    }
+
+    // The caller's frame is popped before the callee's is pushed in its place
+    auto& tailCall = interpreter_.tailCall_;
+    tailCall.assign(stack.begin() + base, stack.end());
+
+    unwind(Op::POP_CALL);
+
+    base = stack.size();
+    stack.insert(stack.end(), tailCall.begin(), tailCall.end());
+    tailCall.clear();
+
+    enterFunction(expr, callee.function_, base + 1);
+}
+
+void StackEvaluator::enterFunction(CallExpr& expr, LoxFunction* function, size_t frame)
+{
+    if (depth_ == maxDepth_) {
+        throw interpreter_error{expr.paren_, "Stack overflow."};
+    }
+    ++depth_;
+
+    tasks_.push_back(Task{Op::POP_CALL, {.function_ = interpreter_.function_}, interpreter_.frame_});
+
+    // The callee stays right below its frame, which keeps it reachable while
+    // it runs; the arguments take the first slots
+    auto& declaration = *function->declaration();
+
+    interpreter_.function_ = function;
+    interpreter_.frame_ = frame;
+    interpreter_.stack_.resize(frame + declaration.scopeSize_, Value::nil());
+
+    pushBlock(declaration.body_);
+}
+
+StackEvaluator::Task StackEvaluator::unwind(Op op)
+{
+    for (;;) {
+        auto task = tasks_.back();
+        tasks_.pop_back();
+
+        switch (task.op_) {
+            case Op::SHOW:
+            {
+                // Statements are shown however they are left
+                std::cout << interpreter_.result_ << std::endl;
+                break;
+            }
+            case Op::LOOP:
+            {
+                // Left by `return`
+                if (op != Op::LOOP) {
+                    showLeftIteration(task);
+                }
+                break;
+            }
+            case Op::CLOSE:
+            {
+                interpreter_.openUpvalues_.close(interpreter_.frame_ + task.index_);
+                break;
+            }
+            case Op::POP_FRAME:
+            {
+                popFrame(task);
+                break;
+            }
+            case Op::POP_CALL:
+            {
+                popCall(task);
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+
+        if (task.op_ == op) {
+            return task;
+        }
+    }
+}
+
+void StackEvaluator::showLeftIteration(const Task& loop)
+{
+    if (interpreter_.repl_mode_ && static_cast<WhileStmt&>(*loop.stmt_).increment_) {
+        std::cout << interpreter_.result_ << std::endl;
+    }
+}
+
+void StackEvaluator::popFrame(const Task& task)
+{
+    auto& block = static_cast<BlockStmt&>(*task.stmt_);
+
+    if (block.closeFrom_ >= 0) {
+        interpreter_.openUpvalues_.close(interpreter_.frame_ + block.closeFrom_);
+    }
+
+    interpreter_.stack_.resize(interpreter_.frame_);
+    interpreter_.frame_ = task.index_;
+}
+
+void StackEvaluator::popCall(const Task& task)
+{
+    auto& declaration = *interpreter_.function_->declaration();
+
+    if (declaration.closeFrom_ >= 0) {
+        interpreter_.openUpvalues_.close(interpreter_.frame_ + declaration.closeFrom_);
+    }
+
+    // Drops the callee along with the frame
+    interpreter_.stack_.resize(interpreter_.frame_ - 1);
+
+    interpreter_.frame_ = task.index_;
+    interpreter_.function_ = task.function_;
+    --depth_;
+}
+
+void StackEvaluator::visitAssignExpr(AssignExprPtr expr)
+{
+    push(Op::ASSIGN, expr.get());
+    push(Op::EVAL, expr->value_.get());
+}
+
+void StackEvaluator::visitBinaryExpr(BinaryExprPtr expr)
+{
+    // The left operand waits on the value stack while the right one is
+    // evaluated, as in Interpreter::visitBinaryExpr
+    push(Op::BINARY, expr.get());
+    push(Op::EVAL, expr->right_.get());
+    push(Op::PUSH);
+    push(Op::EVAL, expr->left_.get());
+}
+
+void StackEvaluator::visitGroupingExpr(GroupingExprPtr expr)
+{
+    push(Op::EVAL, expr->expression_.get());
+}
+
+void StackEvaluator::visitLiteralExpr(LiteralExprPtr expr)
+{
+    interpreter_.visitLiteralExpr(expr);
+}
+
+void StackEvaluator::visitUnaryExpr(UnaryExprPtr expr)
+{
+    push(Op::UNARY, expr.get());
+    push(Op::EVAL, expr->right_.get());
+}
+
+void StackEvaluator::visitVariableExpr(VariableExprPtr expr)
+{
+    interpreter_.visitVariableExpr(expr);
+}
+
+void StackEvaluator::visitLogicalExpr(LogicalExprPtr expr)
+{
+    push(Op::LOGICAL, expr.get());
+    push(Op::EVAL, expr->left_.get());
+}
+
+void StackEvaluator::visitCallExpr(CallExprPtr expr)
+{
+    pushCall(expr.get(), Op::CALL);
+}
+
+void StackEvaluator::visitWhileStmt(WhileStmtPtr stmt)
+{
+    push(Op::WHILE, stmt.get());
+    push(Op::EVAL, stmt->condition_.get());
+}
+
+void StackEvaluator::visitIfStmt(IfStmtPtr stmt)
+{
+    push(Op::IF, stmt.get());
+    push(Op::EVAL, stmt->condition_.get());
+}
+
+void StackEvaluator::visitBlockStmt(BlockStmtPtr stmt)
+{
+    if (stmt->scopeSize_ == 0) {
+        // Its variables, if any, live in the current frame
+        if (stmt->closeFrom_ >= 0) {
+            push(Op::CLOSE, static_cast<size_t>(stmt->closeFrom_));
+        }
+
+        pushBlock(stmt->statements_);
+        return;
+    }
+
+    auto& stack = interpreter_.stack_;
+
+    push(Op::POP_FRAME, stmt.get(), interpreter_.frame_);
+
+    interpreter_.frame_ = stack.size();
+    stack.resize(stack.size() + stmt->scopeSize_, Value::nil());
+
+    pushBlock(stmt->statements_);
+}
+
+void StackEvaluator::visitExpressionStmt(ExpressionStmtPtr stmt)
+{
+    push(Op::EVAL, stmt->expression_.get());
+}
+
+void StackEvaluator::visitPrintStmt(PrintStmtPtr stmt)
+{
+    push(Op::PRINT, stmt.get());
+    push(Op::EVAL, stmt->expression_.get());
+}
+
+void StackEvaluator::visitVarStmt(VarStmtPtr stmt)
+{
+    if (stmt->initializer_) {
+        push(Op::VAR, stmt.get());
+        push(Op::EVAL, stmt->initializer_.get());
+    } else {
+        interpreter_.declare(stmt->slot_, stmt->name_, Value::nil());
+    }
+}
+
+void StackEvaluator::visitFunctionStmt(FunctionStmtPtr stmt)
+{
+    interpreter_.visitFunctionStmt(stmt);
+}
+
+void StackEvaluator::visitReturnStmt(ReturnStmtPtr stmt)
+{
+    if (stmt->tailCall_) {
+        pushCall(static_cast<CallExpr*>(stmt->value_.get()), Op::TAIL_CALL);
+    } else if (stmt->value_) {
+        push(Op::RETURN);
+        push(Op::EVAL, stmt->value_.get());
+    } else {
+        interpreter_.result_ = Value::nil();
+        unwind(Op::POP_CALL);
+    }
+}
+
+void StackEvaluator::visitBreakStmt(BreakStmtPtr)
+{
+    showLeftIteration(unwind(Op::LOOP));
+}
+
+void StackEvaluator::visitContinueStmt(ContinueStmtPtr)
+{
+    // The loop goes on with its increment and condition
+    tasks_.push_back(unwind(Op::LOOP));
+}
+
+void StackEvaluator::visitClassStmt(ClassStmtPtr stmt)
+{
+    interpreter_.visitClassStmt(stmt);
+}
@@ -0,0 +1,20 @@
+#include "stack_limit.hpp"
+
+#include <algorithm>
+
+#include <sys/resource.h>
+
+size_t stackBudget()
+{
+    constexpr size_t DEFAULT_STACK_BYTES = 8 * 1024 * 1024;
+    constexpr size_t MAX_STACK_BYTES = 1024 * 1024 * 1024;
+
+    size_t bytes = DEFAULT_STACK_BYTES;
+    rlimit limit;
+
+    if (getrlimit(RLIMIT_STACK, &limit) == 0) {
+        bytes = limit.rlim_cur == RLIM_INFINITY ? MAX_STACK_BYTES : std::min<size_t>(limit.rlim_cur, MAX_STACK_BYTES);
+    }
+
+    return bytes / 4 * 3;
+}
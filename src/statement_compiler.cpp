@@ -0,0 +1,52 @@
+#include "statement_compiler.hpp"
+
+StatementCompiler::StatementCompiler(bool repl_mode)
+    : repl_mode_{repl_mode}
+{ }
+
+void StatementCompiler::statement(const StmtPtr& stmt)
+{
+    ++shows_;
+    compile(stmt);
+    --shows_;
+
+    if (repl_mode_) {
+        emitShow();
+    }
+}
+
+StatementCompiler::Loop StatementCompiler::loopBody(WhileStmt& stmt, size_t scopes)
+{
+    if (stmt.increment_) {
+        loops_.push_back(Loop{scopes, shows_, shows_ + 1, {}, {}});
+
+        ++shows_;
+        compile(stmt.statements_);
+    } else {
+        loops_.push_back(Loop{scopes, shows_, shows_, {}, {}});
+
+        statement(stmt.statements_);
+    }
+
+    auto loop = std::move(loops_.back());
+    loops_.pop_back();
+    return loop;
+}
+
+void StatementCompiler::showIncrement()
+{
+    --shows_;
+
+    if (repl_mode_) {
+        emitShow();
+    }
+}
+
+void StatementCompiler::leaveShows(size_t shows)
+{
+    if (repl_mode_) {
+        for (auto i = shows; i < shows_; ++i) {
+            emitShow();
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#include "string_table.hpp"
+
+StringTable::StringTable(Heap& heap)
+    : heap_{heap}
+    , entries_(INITIAL_CAPACITY, nullptr)
+{ }
+
+LoxString* StringTable::intern(std::string_view chars)
+{
+    auto hash = LoxString::hashOf(chars);
+    auto mask = entries_.size() - 1;
+
+    for (auto index = hash & mask; ; index = (index + 1) & mask) {
+        auto entry = entries_[index];
+
+        if (!entry) {
+            break;
+        }
+
+        if (entry->hash() == hash && entry->chars() == chars) {
+            return entry;
+        }
+    }
+
+    if ((count_ + 1) * 4 > entries_.size() * 3) {
+        grow();
+        mask = entries_.size() - 1;
+    }
+
+    auto string = heap_.makePermanent<LoxString>(std::string{chars});
+    string->interned_ = true;
+
+    auto index = hash & mask;
+    while (entries_[index]) {
+        index = (index + 1) & mask;
+    }
+    entries_[index] = string;
+    ++count_;
+
+    return string;
+}
+
+void StringTable::grow()
+{
+    std::vector<LoxString*> entries(entries_.size() * 2, nullptr);
+    auto mask = entries.size() - 1;
+
+    for (auto string: entries_) {
+        if (!string) continue;
+
+        auto index = string->hash() & mask;
+        while (entries[index]) {
+            index = (index + 1) & mask;
+        }
+        entries[index] = string;
+    }
+
+    entries_ = std::move(entries);
+}
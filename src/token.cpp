@@ -28,7 +28,9 @@ const char* getTokenTypeStr(TokenType tokenType)
         case TokenType::STRING: return "STRING";
         case TokenType::NUMBER: return "NUMBER";
         case TokenType::AND: return "AND";
+        case TokenType::BREAK: return "BREAK";
         case TokenType::CLASS: return "CLASS";
+        case TokenType::CONTINUE: return "CONTINUE";
         case TokenType::ELSE: return "ELSE";
         case TokenType::FALSE: return "FALSE";
         case TokenType::FUN: return "FUN";
@@ -48,7 +50,7 @@ const char* getTokenTypeStr(TokenType tokenType)
     }
 }
 
-Token::Token(TokenType tokenType, LoxValuePtr value, std::string lexeme, size_t line)
+Token::Token(TokenType tokenType, Value value, std::string lexeme, size_t line)
     : tokenType_{tokenType}
     , value_{value}
     , lexeme_{lexeme}
@@ -60,7 +62,7 @@ std::ostream& operator<<(std::ostream& out, Token& token)
     out << "Type [" << getTokenTypeStr(token.tokenType_) << ']';
 
     if (token.tokenType_ == TokenType::STRING || token.tokenType_ == TokenType::NUMBER) {
-        out << "\tValue [" << *(token.value_) << ']';
+        out << "\tValue [" << token.value_ << ']';
     }
 
     if (token.tokenType_ != TokenType::END_OF_FILE) {
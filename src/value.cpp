@@ -1,60 +1,150 @@
 #include "value.hpp"
 
 #include <ostream>
+#include <vector>
 
-std::ostream& operator<<(std::ostream& o, LoxValue& value)
+ValueStats Value::stats_;
+
+Value Value::boxInteger(int64_t value, Heap& heap)
 {
-    value.operator<<(o);
-    return o;
+    ++stats_.boxed_;
+    return Value{heap.make<LoxInteger>(value)};
 }
 
-LoxString::LoxString(std::string value)
-    : value_{value}
-{}
+Value Value::integerConstant(int64_t value, Heap& heap)
+{
+    if (value < SMALL_INT_MIN || value > SMALL_INT_MAX) {
+        ++stats_.boxed_;
+        return Value{heap.makePermanent<LoxInteger>(value)};
+    }
+    return integer(value, heap);
+}
 
-std::ostream& LoxString::operator<<(std::ostream& o)
+std::ostream& operator<<(std::ostream& o, LoxObject& object)
 {
-    o << value_;
+    object.operator<<(o);
     return o;
 }
 
-LoxInteger::LoxInteger(int64_t value)
-    : value_{value}
-{}
-
-std::ostream& LoxInteger::operator<<(std::ostream& o)
+std::ostream& operator<<(std::ostream& o, const Value& value)
 {
-    o << value_;
+    if (value.isFloat()) {
+        o << value.asDouble();
+    } else if (value.isSmallInt()) {
+        o << value.asSmallInt();
+    } else if (value.isBool()) {
+        if (value.asBool()) {
+            o << "true";
+        } else {
+            o << "false";
+        }
+    } else if (value.isNil()) {
+        o << "nil";
+    } else {
+        o << *value.asObject();
+    }
     return o;
 }
 
-LoxFloat::LoxFloat(double value)
-    : value_{value}
+LoxString::LoxString(std::string value)
+    : LoxObject{ObjType::STRING}
+    , chars_{std::move(value)}
+    , length_{chars_.size()}
 {}
 
-std::ostream& LoxFloat::operator<<(std::ostream& o)
+LoxString::LoxString(LoxString* left, LoxString* right)
+    : LoxObject{ObjType::STRING}
+    , length_{left->length_ + right->length_}
+    , left_{left}
+    , right_{right}
+{}
+
+LoxString::LoxString(LoxString* base, size_t offset, size_t length)
+    : LoxObject{ObjType::STRING}
+    , length_{length}
+    , offset_{offset}
 {
-    o << value_;
-    return o;
+    if (base->isSlice()) {
+        offset_ += base->offset_;
+        base = base->base_;
+    } else if (base->isRope()) {
+        base->flatten();
+    }
+
+    base_ = base;
 }
 
-LoxBool::LoxBool(bool value)
-    : value_{value}
-{}
+void LoxString::flatten()
+{
+    std::string chars;
+    chars.reserve(length_);
+
+    std::vector<LoxString*> stack{right_, left_};
+
+    while (!stack.empty()) {
+        auto string = stack.back();
+        stack.pop_back();
 
-std::ostream& LoxBool::operator<<(std::ostream& o)
+        if (string->isRope()) {
+            stack.push_back(string->right_);
+            stack.push_back(string->left_);
+        } else {
+            chars.append(string->chars());
+        }
+    }
+
+    // A concurrent marker may be tracing this rope. The children dropped
+    // here need no shading: nothing else can reach them through it.
+    GcLock lock{this};
+
+    chars_ = std::move(chars);
+    left_ = right_ = nullptr;
+}
+
+void LoxString::trace(Heap& heap)
 {
-    if (value_) {
-        o << "true";
-    } else {
-        o << "false";
+    // Ropes built by appending in a loop are chains as long as the number
+    // of appends; the heap's gray stack keeps marking them iterative.
+    heap.mark(left_);
+    heap.mark(right_);
+    heap.mark(base_);
+}
+
+size_t LoxString::footprint() const
+{
+    return sizeof(LoxString) + chars_.capacity();
+}
+
+GcObject* LoxString::relocate(SlabAllocator& allocator)
+{
+    return allocator.make<LoxString>(std::move(*this));
+}
+
+uint32_t LoxString::hashOf(std::string_view chars)
+{
+    uint32_t hash = 2166136261u;
+
+    for (char c: chars) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
     }
-    return o;
+
+    return hash;
 }
 
-std::ostream& LoxNil::operator<<(std::ostream& o)
+std::ostream& LoxString::operator<<(std::ostream& o)
 {
-    o << "nil";
+    o << chars();
     return o;
 }
 
+LoxInteger::LoxInteger(int64_t value)
+    : LoxObject{ObjType::INTEGER}
+    , value_{value}
+{}
+
+std::ostream& LoxInteger::operator<<(std::ostream& o)
+{
+    o << value_;
+    return o;
+}
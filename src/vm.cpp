@@ -0,0 +1,490 @@
+#include "vm.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "function.hpp"
+#include "lox_class.hpp"
+#include "lox_exception.hpp"
+
+// Threaded dispatch, where every instruction jumps straight to the next
+// one's handler, needs the labels-as-values extension
+#if defined(__GNUC__) || defined(__clang__)
+#define LOX_COMPUTED_GOTO
+#endif
+
+VM::VM(Interpreter& interpreter, size_t maxDepth, size_t maxStackSlots)
+    : interpreter_{interpreter}
+    , compiler_{interpreter.repl_mode_}
+    , maxDepth_{maxDepth}
+    , stack_{interpreter.heap_, maxStackSlots}
+{
+    interpreter_.heap_.addRoots(this);
+}
+
+VM::~VM()
+{
+    interpreter_.heap_.removeRoots(this);
+}
+
+void VM::interpret(const std::vector<StmtPtr>& statements)
+{
+    try {
+        auto script = compiler_.compile(statements);
+
+        if (!growStack(std::max(INITIAL_STACK_SLOTS, script->maxStack_))) {
+            throw compile_error{"Top-level code needs more stack than there is."};
+        }
+
+        frames_.push_back(CallFrame{nullptr, script.get(), script->code_.data(), sp_});
+        run();
+    } catch (compile_error& error) {
+        std::cerr << "Compile error: " << error.what() << std::endl;
+    } catch (interpreter_error& error) {
+        reset();
+        interpreter_.abort(error);
+    }
+}
+
+void VM::run()
+{
+    auto& heap = interpreter_.heap_;
+    auto& global = interpreter_.global_;
+    auto& result = interpreter_.result_;
+
+    auto nil = Value::nil();
+
+    // The innermost frame is kept in locals, and only written back to
+    // frames_ when it makes a call
+    auto frame = &frames_.back();
+    auto function = frame->function_;
+    auto chunk = frame->chunk_;
+    auto ip = frame->ip_;
+    auto slots = frame->slots_;
+    auto sp = sp_;
+
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>(ip[-2] | (ip[-1] << 8)))
+#define TOKEN(index) (chunk->tokens_[index])
+
+    // Makes the function whose arguments start at `args` the running one,
+    // in a new frame record or the innermost one
+    auto enter = [&](LoxFunction* callee, Value* args, uint16_t token, bool push) {
+        auto& declaration = *callee->declaration();
+        auto code = declaration.chunk_.get();
+
+        size_t argsIndex = args - stack_.data();
+
+        if (argsIndex + code->maxStack_ > stack_.size()) {
+            sp_ = sp;
+
+            if (!growStack(argsIndex + code->maxStack_)) {
+                throw interpreter_error{TOKEN(token), "Stack overflow."};
+            }
+
+            sp = sp_;
+            args = stack_.data() + argsIndex;
+        }
+
+        if (push) {
+            frames_.emplace_back();
+        }
+
+        while (sp < args + declaration.scopeSize_) {
+            *sp++ = nil;
+        }
+
+        function = callee;
+        chunk = code;
+        ip = code->code_.data();
+        slots = args;
+
+        frame = &frames_.back();
+        *frame = CallFrame{function, chunk, ip, slots};
+
+        sp_ = sp;
+        heap.safepoint();
+    };
+
+    // Returns from the running function; false once the top-level code has
+    auto leave = [&](const Value& value) {
+        if (function && function->declaration()->closeFrom_ >= 0) {
+            stack_.closeUpvalues(slots + function->declaration()->closeFrom_);
+        }
+
+        frames_.pop_back();
+
+        if (frames_.empty()) {
+            sp_ = slots;
+            return false;
+        }
+
+        // The callee's slot takes the value
+        sp = slots - 1;
+        *sp++ = value;
+
+        frame = &frames_.back();
+        function = frame->function_;
+        chunk = frame->chunk_;
+        ip = frame->ip_;
+        slots = frame->slots_;
+        return true;
+    };
+
+    // Calls anything but a LoxFunction taking these many arguments, which
+    // is either a native or an error
+    auto callOther = [&](const Value& callee, uint8_t argc, uint16_t token) {
+        interpreter_.checkCallee(TOKEN(token), callee, argc);
+
+        try {
+            return callee.as<LoxNative>()->call(interpreter_, std::span<Value>{sp - argc, argc});
+        } catch (native_error& error) {
+            throw interpreter_error{TOKEN(token), error.what()};
+        }
+    };
+
+#ifdef LOX_COMPUTED_GOTO
+    static const void* const dispatch[] = {
+#define LOX_OPCODE_LABEL(name) &&op_##name,
+        LOX_OPCODES(LOX_OPCODE_LABEL)
+#undef LOX_OPCODE_LABEL
+    };
+
+#define DISPATCH() goto *dispatch[*ip++]
+#define TARGET(name) op_##name
+
+    DISPATCH();
+#else
+#define DISPATCH() continue
+#define TARGET(name) case OpCode::name
+
+    for (;;) switch (static_cast<OpCode>(*ip++))
+#endif
+    {
+        TARGET(CONSTANT):
+        {
+            *sp++ = chunk->constants_[READ_SHORT()];
+            DISPATCH();
+        }
+        TARGET(NIL):
+        {
+            *sp++ = nil;
+            DISPATCH();
+        }
+        TARGET(POP):
+        {
+            --sp;
+            DISPATCH();
+        }
+        TARGET(POP_RESULT):
+        {
+            result = *--sp;
+            DISPATCH();
+        }
+        TARGET(RESULT):
+        {
+            result = sp[-1];
+            DISPATCH();
+        }
+        TARGET(POPN):
+        {
+            sp -= READ_SHORT();
+            DISPATCH();
+        }
+        TARGET(RESERVE):
+        {
+            for (auto n = READ_SHORT(); n > 0; --n) {
+                *sp++ = nil;
+            }
+            DISPATCH();
+        }
+        TARGET(GET_LOCAL):
+        {
+            *sp++ = slots[READ_SHORT()];
+            DISPATCH();
+        }
+        TARGET(SET_LOCAL):
+        {
+            slots[READ_SHORT()] = sp[-1];
+            DISPATCH();
+        }
+        TARGET(GET_UPVALUE):
+        {
+            *sp++ = function->upvalue(READ_SHORT())->get();
+            DISPATCH();
+        }
+        TARGET(SET_UPVALUE):
+        {
+            function->upvalue(READ_SHORT())->set(sp[-1]);
+            DISPATCH();
+        }
+        TARGET(GET_GLOBAL):
+        {
+            auto& ref = chunk->globals_[READ_SHORT()];
+            *sp++ = global.get(ref.name_, ref.cell_);
+            DISPATCH();
+        }
+        TARGET(SET_GLOBAL):
+        {
+            auto& ref = chunk->globals_[READ_SHORT()];
+            global.assign(ref.name_, ref.cell_, sp[-1]);
+            DISPATCH();
+        }
+        TARGET(DEFINE_GLOBAL):
+        {
+            global.define(chunk->globals_[READ_SHORT()].name_->symbol_, sp[-1]);
+            DISPATCH();
+        }
+
+        // Operands of the same representation are handled inline, anything
+        // else (and every error) the way the interpreter does
+#define BINARY_OP(intOp, floatOp)                                                   \
+        {                                                                           \
+            auto token = READ_SHORT();                                              \
+            auto left = sp[-2];                                                     \
+            auto right = sp[-1];                                                    \
+                                                                                    \
+            if (left.isSmallInt() && right.isSmallInt()) {                          \
+                auto a = left.asSmallInt(), b = right.asSmallInt();                 \
+                sp[-2] = intOp;                                                     \
+            } else if (left.isFloat() && right.isFloat()) {                         \
+                auto a = left.asDouble(), b = right.asDouble();                     \
+                sp[-2] = floatOp;                                                   \
+            } else {                                                                \
+                interpreter_.applyBinary(TOKEN(token), left, right);                \
+                sp[-2] = result;                                                    \
+            }                                                                       \
+                                                                                    \
+            --sp;                                                                   \
+            DISPATCH();                                                             \
+        }
+
+        TARGET(EQUAL):
+        {
+            auto right = *--sp;
+            sp[-1] = Value::boolean(interpreter_.isEqual(sp[-1], right));
+            DISPATCH();
+        }
+        TARGET(NOT_EQUAL):
+        {
+            auto right = *--sp;
+            sp[-1] = Value::boolean(!interpreter_.isEqual(sp[-1], right));
+            DISPATCH();
+        }
+        TARGET(GREATER):
+            BINARY_OP(Value::boolean(a > b), Value::boolean(a > b))
+        TARGET(GREATER_EQUAL):
+            BINARY_OP(Value::boolean(a >= b), Value::boolean(a >= b))
+        TARGET(LESS):
+            BINARY_OP(Value::boolean(a < b), Value::boolean(a < b))
+        TARGET(LESS_EQUAL):
+            BINARY_OP(Value::boolean(a <= b), Value::boolean(a <= b))
+        TARGET(ADD):
+            BINARY_OP(Value::integer(a + b, heap), Value::number(a + b))
+        TARGET(SUBTRACT):
+            BINARY_OP(Value::integer(a - b, heap), Value::number(a - b))
+        TARGET(MULTIPLY):
+            BINARY_OP(Value::integer(a * b, heap), Value::number(a * b))
+#undef BINARY_OP
+        TARGET(DIVIDE):
+        {
+            // Division by zero is checked by the interpreter
+            auto token = READ_SHORT();
+            interpreter_.applyBinary(TOKEN(token), sp[-2], sp[-1]);
+
+            --sp;
+            sp[-1] = result;
+            DISPATCH();
+        }
+        TARGET(NOT):
+        {
+            sp[-1] = Value::boolean(!interpreter_.isTruthy(sp[-1]));
+            DISPATCH();
+        }
+        TARGET(NEGATE):
+        {
+            auto token = READ_SHORT();
+            auto value = sp[-1];
+
+            if (value.isSmallInt()) {
+                sp[-1] = Value::integer(-value.asSmallInt(), heap);
+            } else if (value.isFloat()) {
+                sp[-1] = Value::number(-value.asDouble());
+            } else {
+                interpreter_.applyUnary(TOKEN(token), value);
+                sp[-1] = result;
+            }
+            DISPATCH();
+        }
+        TARGET(PRINT):
+        {
+            result = *--sp;
+            std::cout << result << std::endl;
+            DISPATCH();
+        }
+        TARGET(SHOW):
+        {
+            std::cout << result << std::endl;
+            DISPATCH();
+        }
+        TARGET(JUMP):
+        {
+            auto offset = READ_SHORT();
+            ip += offset;
+            DISPATCH();
+        }
+        TARGET(JUMP_IF_FALSE):
+        {
+            auto offset = READ_SHORT();
+
+            if (!interpreter_.isTruthy(sp[-1])) {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        TARGET(JUMP_IF_TRUE):
+        {
+            auto offset = READ_SHORT();
+
+            if (interpreter_.isTruthy(sp[-1])) {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        TARGET(POP_JUMP_IF_FALSE):
+        {
+            auto offset = READ_SHORT();
+
+            if (!interpreter_.isTruthy(*--sp)) {
+                ip += offset;
+            }
+            DISPATCH();
+        }
+        TARGET(LOOP):
+        {
+            auto offset = READ_SHORT();
+            ip -= offset;
+
+            sp_ = sp;
+            heap.safepoint();
+            DISPATCH();
+        }
+        TARGET(CALL):
+        {
+            auto argc = READ_BYTE();
+            auto token = READ_SHORT();
+            auto callee = sp[-argc - 1];
+
+            if (callee.isObjType(ObjType::FUNCTION) && callee.as<LoxFunction>()->arity() == argc) {
+                if (frames_.size() > maxDepth_) {
+                    throw interpreter_error{TOKEN(token), "Stack overflow."};
+                }
+
+                frame->ip_ = ip;
+                enter(callee.as<LoxFunction>(), sp - argc, token, true);
+            } else {
+                auto value = callOther(callee, argc, token);
+
+                sp -= argc;
+                sp[-1] = value;
+            }
+            DISPATCH();
+        }
+        TARGET(TAIL_CALL):
+        {
+            auto argc = READ_BYTE();
+            auto token = READ_SHORT();
+            auto callee = sp[-argc - 1];
+
+            if (callee.isObjType(ObjType::FUNCTION) && callee.as<LoxFunction>()->arity() == argc) {
+                // The callee and its arguments replace the caller's frame
+                if (function->declaration()->closeFrom_ >= 0) {
+                    stack_.closeUpvalues(slots + function->declaration()->closeFrom_);
+                }
+
+                std::copy(sp - argc - 1, sp, slots - 1);
+                sp = slots + argc;
+
+                enter(callee.as<LoxFunction>(), slots, token, false);
+                DISPATCH();
+            }
+
+            if (!leave(callOther(callee, argc, token))) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(RETURN):
+        {
+            if (!leave(sp[-1])) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(RETURN_NIL):
+        {
+            if (!leave(nil)) {
+                return;
+            }
+            DISPATCH();
+        }
+        TARGET(CLOSURE):
+        {
+            auto stmt = chunk->functions_[READ_SHORT()];
+
+            std::vector<Upvalue*> upvalues;
+            upvalues.reserve(stmt->captures_.size());
+
+            for (size_t i = 0; i < stmt->captures_.size(); ++i) {
+                auto local = READ_BYTE();
+                auto index = READ_SHORT();
+
+                upvalues.push_back(local ? stack_.captureUpvalue(slots + index) : function->upvalue(index));
+            }
+
+            *sp++ = Value{heap.make<LoxFunction>(FunctionStmtPtr{stmt}, std::move(upvalues))};
+            DISPATCH();
+        }
+        TARGET(CLASS):
+        {
+            *sp++ = Value{heap.make<LoxClass>(TOKEN(READ_SHORT())->lexeme_)};
+            DISPATCH();
+        }
+        TARGET(CLOSE_UPVALUES):
+        {
+            stack_.closeUpvalues(slots + READ_SHORT());
+            DISPATCH();
+        }
+    }
+
+#undef DISPATCH
+#undef TARGET
+#undef TOKEN
+#undef READ_SHORT
+#undef READ_BYTE
+}
+
+bool VM::growStack(size_t slots)
+{
+    return stack_.grow(slots, [this](auto rebase) {
+        for (auto& frame: frames_) {
+            rebase(frame.slots_);
+        }
+
+        rebase(sp_);
+    });
+}
+
+void VM::reset()
+{
+    // The frames are gone, but closures may still be reachable
+    stack_.closeUpvalues(stack_.data());
+
+    sp_ = stack_.data();
+    frames_.clear();
+}
+
+void VM::markRoots(Heap& heap)
+{
+    stack_.markRoots(heap, sp_);
+}
@@ -0,0 +1,15 @@
+#include "vm_stack.hpp"
+
+VMStack::VMStack(Heap& heap, size_t maxSlots)
+    : maxSlots_{maxSlots}
+    , openUpvalues_{heap, slots_}
+{ }
+
+void VMStack::markRoots(Heap& heap, Value* top)
+{
+    openUpvalues_.markRoots(heap);
+
+    for (auto slot = slots_.data(); slot < top; ++slot) {
+        heap.mark(*slot);
+    }
+}
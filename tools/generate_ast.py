@@ -2,20 +2,37 @@
 
 import sys
 
+# Types that are stored by value instead of through a Ref
+value_types = [ "Value", "int", "bool", "BinaryForm", "CallCache" ]
+
+def field_type(type_name):
+    if type_name in value_types or type_name.startswith("std::vector") or type_name.endswith("*"):
+        return type_name
+    return f"Ref<{type_name}>"
+
 def define_ast(output_dir, base_class, ast_types, dependencies = []):
     with open(file=f"{output_dir}/{str.lower(base_class)}.hpp", mode="w") as output_file:
         output_file.write("#pragma once\n\n")
 
         output_file.write("#include <vector>\n\n")
 
+        output_file.write("#include \"ref.hpp\"\n\n")
+
         for dependecy in dependencies:
             output_file.write(f"#include \"{dependecy}\"\n\n")
 
+        # Raw pointer fields only need their type declared
+        pointees = sorted({x.split()[0][:-1] for v in ast_types.values() for x in v.split('|') if x.split()[0].endswith("*")})
+        if pointees:
+            for pointee in pointees:
+                output_file.write(f"struct {pointee};\n")
+            output_file.write("\n")
+
         for k in ast_types:
             output_file.write(f"struct {k}{base_class};\n");
         output_file.write("\n");
 
-        output_file.write(f"struct {base_class}\n")
+        output_file.write(f"struct {base_class}: public RefCounted\n")
         output_file.write("{\n")
 
         # AbstractVisitor structure
@@ -23,7 +40,7 @@ def define_ast(output_dir, base_class, ast_types, dependencies = []):
         output_file.write("\t{\n")
 
         for k in ast_types:
-            output_file.write(f"\t\tvirtual void visit{k}{base_class}(std::shared_ptr<{k}{base_class}> {str.lower(base_class)}) = 0;\n")
+            output_file.write(f"\t\tvirtual void visit{k}{base_class}(Ref<{k}{base_class}> {str.lower(base_class)}) = 0;\n")
 
         output_file.write("\t};\n\n")
 
@@ -31,21 +48,31 @@ def define_ast(output_dir, base_class, ast_types, dependencies = []):
         output_file.write(f"\tvirtual ~{base_class}() = default;\n")
         output_file.write("};\n\n")
 
-        output_file.write(f"using {base_class}Ptr = std::shared_ptr<{base_class}>;\n\n")
+        output_file.write(f"using {base_class}Ptr = Ref<{base_class}>;\n\n")
 
         for k, v in ast_types.items():
-            attrs = [[x.strip().split()[0].strip(), x.strip().split()[1].strip()] for x in v.split('|') ]
-
-            output_file.write(f"struct {k}{base_class}: public {base_class}, public std::enable_shared_from_this<{k}{base_class}>\n")
+            # Fields are "Type name", or "Type name = default" for the ones
+            # filled in after parsing (e.g. by the resolver), which are left
+            # out of the constructor
+            fields = [[part.strip() for part in x.partition('=')[::2]] for x in v.split('|')]
+            fields = [x[0].split() + [x[1]] for x in fields]
+            attrs = [x[:2] for x in fields if not x[2]]
+
+            output_file.write(f"struct {k}{base_class}: public {base_class}\n")
             output_file.write("{\n")
 
-            for var in attrs:
-                output_file.write(f"\tstd::shared_ptr<{var[0]}> {var[1]}_;\n")
+            for var in fields:
+                if var[2] == "{}":
+                    output_file.write(f"\t{field_type(var[0])} {var[1]}_{{}};\n")
+                elif var[2]:
+                    output_file.write(f"\t{field_type(var[0])} {var[1]}_{{{var[2]}}};\n")
+                else:
+                    output_file.write(f"\t{field_type(var[0])} {var[1]}_;\n")
 
             output_file.write("\n")
 
             # Constructor
-            c_args = ", ".join([f"std::shared_ptr<{x[0]}> {x[1]}" for x in attrs])
+            c_args = ", ".join([f"{field_type(x[0])} {x[1]}" for x in attrs])
             init_args = "\t\t, ".join([f"{x[1]}_{{std::move({x[1]})}}\n" for x in attrs])
 
             output_file.write(f"\t{k}{base_class}({c_args})\n")
@@ -54,11 +81,11 @@ def define_ast(output_dir, base_class, ast_types, dependencies = []):
 
             # Override accept() function
             output_file.write("\tvoid accept(AbstractVisitor& visitor) override {\n")
-            output_file.write(f"\t\tvisitor.visit{k}{base_class}(shared_from_this());\n")
+            output_file.write(f"\t\tvisitor.visit{k}{base_class}(Ref<{k}{base_class}>{{this}});\n")
             output_file.write("\t}\n")
 
             output_file.write("};\n\n")
-            output_file.write(f"using {k}{base_class}Ptr = std::shared_ptr<{k}{base_class}>;\n\n")
+            output_file.write(f"using {k}{base_class}Ptr = Ref<{k}{base_class}>;\n\n")
 
 def main():
     if len(sys.argv) != 2:
@@ -66,27 +93,29 @@ def main():
         sys.exit(1)
 
     define_ast(sys.argv[1], "Expr", {
-        "Assign": "Token name | Expr value",
-        "Binary": "Expr left | Token op | Expr right",
+        "Assign": "Token name | Expr value | int slot = -1 | int upvalue = -1 | GlobalCell* global = nullptr",
+        "Binary": "Expr left | Token op | Expr right | BinaryForm form = BinaryForm::UNSPECIALIZED",
         "Grouping": "Expr expression",
-        "Literal": "LoxValue value",
+        "Literal": "Value value",
         "Unary": "Token op | Expr right",
-        "Variable": "Token name",
+        "Variable": "Token name | int slot = -1 | int upvalue = -1 | GlobalCell* global = nullptr",
         "Logical": "Expr left | Token op | Expr right",
-        "Call": "Expr callee | Token paren | std::vector<ExprPtr> args"
-    }, [ "token.hpp" ])
+        "Call": "Expr callee | Token paren | std::vector<ExprPtr> args | CallCache cache = {}"
+    }, [ "token.hpp", "binary_form.hpp", "call_cache.hpp" ])
 
     define_ast(sys.argv[1], "Stmt", {
-        "While": "Expr condition | Stmt statements",
+        "While": "Expr condition | Stmt statements | Expr increment",
         "If": "Expr condition | Stmt thenStmt | Stmt elseStmt",
-        "Block": "std::vector<StmtPtr> statements",
+        "Block": "std::vector<StmtPtr> statements | int scopeSize = 0 | int closeFrom = -1",
         "Expression": "Expr expression",
         "Print": "Expr expression",
-        "Var": "Token name | Expr initializer",
-        "Function": "Token name | std::vector<TokenPtr> params | std::vector<StmtPtr> body",
-        "Return": "Token keyword | Expr value",
-        "Class": "Token name | std::vector<FunctionStmtPtr> methods"
-    }, [ "expr.hpp" ])
+        "Var": "Token name | Expr initializer | int slot = -1",
+        "Function": "Token name | std::vector<TokenPtr> params | std::vector<StmtPtr> body | int slot = -1 | int scopeSize = 0 | int closeFrom = -1 | std::vector<Capture> captures = {} | Chunk chunk = {} | RegisterChunk registerChunk = {} | ClosureCode closureCode = {}",
+        "Return": "Token keyword | Expr value | bool tailCall = false",
+        "Break": "Token keyword",
+        "Continue": "Token keyword",
+        "Class": "Token name | std::vector<FunctionStmtPtr> methods | int slot = -1"
+    }, [ "expr.hpp", "capture.hpp", "chunk.hpp", "register_chunk.hpp", "closure_code.hpp" ])
 
 if __name__ == "__main__":
     main()